@@ -20,9 +20,37 @@ Encrypt with a total of 10 rounds for 128-bit AES
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
 
 using namespace std;
 
@@ -47,6 +75,28 @@ unsigned char sBox[256] =   {
 0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 
 }; 
 
+/* Inverse of the S-box above, fetched from https://en.wikipedia.org/wiki/Rijndael_S-box, used for the InvSubBytes step
+   when decrypting */
+unsigned char invSBox[256] = {
+
+0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb, 
+0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb, 
+0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e, 
+0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25, 
+0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92, 
+0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84, 
+0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06, 
+0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b, 
+0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73, 
+0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e, 
+0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b, 
+0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4, 
+0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f, 
+0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef, 
+0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61, 
+0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d 
+};
+
 /* 16x16 rcon, fetched from https://en.wikipedia.org/wiki/Rijndael_key_schedule, used for deriving a subkey in the 
 	AddRoundKey step and when expanding keys*/
 unsigned char rcon[256] = {
@@ -87,6 +137,52 @@ void key_schedule_core(unsigned char *t, int rcon_i){
 
 }
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI_PATH 1
+
+/* One step of the AES-128 key schedule with AESKEYGENASSIST, which does the rotate, sbox and rcon part */
+__attribute__((target("aes,sse2")))
+inline __m128i keyExpansionStep(__m128i key, __m128i assist){
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+/* AES-NI version of expandKey for a 16 byte key. The rcon value has to be an immediate, hence the macro */
+__attribute__((target("aes,sse2")))
+void expandKeyAesni(const unsigned char* key, unsigned char* expanded_key){
+	__m128i k = _mm_loadu_si128((const __m128i*) key);
+	_mm_storeu_si128((__m128i*) expanded_key, k);
+#define EXPAND_STEP(i, rcon) \
+	k = keyExpansionStep(k, _mm_aeskeygenassist_si128(k, rcon)); \
+	_mm_storeu_si128((__m128i*) (expanded_key + 16*i), k);
+	EXPAND_STEP(1, 0x01)
+	EXPAND_STEP(2, 0x02)
+	EXPAND_STEP(3, 0x04)
+	EXPAND_STEP(4, 0x08)
+	EXPAND_STEP(5, 0x10)
+	EXPAND_STEP(6, 0x20)
+	EXPAND_STEP(7, 0x40)
+	EXPAND_STEP(8, 0x80)
+	EXPAND_STEP(9, 0x1b)
+	EXPAND_STEP(10, 0x36)
+#undef EXPAND_STEP
+}
+#endif
+
+/* Whether expandKey and encryptBlocks hand their work to AES-NI. Decided once from what the cpu supports,
+   and may be cleared to force the reference rounds (e.g. to compare the two) */
+int selectAesni(){
+#ifdef HAVE_AESNI_PATH
+	return __builtin_cpu_supports("aes");
+#else
+	return 0;
+#endif
+}
+int use_aesni = selectAesni();
+
 /* 	Expands the key
 	Theory implemented from https://en.wikipedia.org/wiki/Rijndael_key_schedule#The_key_schedule
 */
@@ -95,6 +191,12 @@ void expandKey(unsigned char *key, int key_size, unsigned char *expanded_key, in
 	int current_size_of_key = 0; //stores the value of the current key size
 	unsigned char t[4] = {0}; //temp variable of size 4 bytes
 
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni && key_size == 16 && expanded_key_size == 176){
+		expandKeyAesni(key, expanded_key);
+		return;
+	}
+#endif
 
 	for(int i = 0; i < key_size; ++i){ //copy the encryption key as the first 16 bytes in the extended key
 		expanded_key[i] = key[i];
@@ -243,86 +345,6541 @@ void mixColumns(unsigned char** state){
     delete temp;
 }
 
-int main(){
-	unsigned char *key;
-	unsigned char *input;
-	//One block is 16 bytes (128 bits), initialize arrays:
-	key = new unsigned char[16];
-	input = new unsigned char[16];
-	char block[16];
-	cin.read(block,16); //Read a 16 bytes, store in block. This represents the key
-	//now we need to store the key in the key array, but we need to cast each byte to an unsigned char
+/* ---------- Inverse cipher ----------
+   Theory from https://en.wikipedia.org/wiki/Advanced_Encryption_Standard and FIPS-197 section 5.3.
+   The same steps as above, undone in reverse order */
+
+/* Perform the inverse sub byte operation using the inverse s-box */
+void invSubBytes(unsigned char** state){
+	for(int i = 0; i < 4; ++i){
+		for(int j = 0; j < 4; ++j){
+			state[i][j] = invSBox[(state[i][j])];
+		}
+	}
+}
+
+/* Shift the rows back to the right, undoing shiftRows */
+void invShiftRows(unsigned char** state){
+	unsigned char temp;
+
+	//Row 2
+	temp = state[1][3];
+	state[1][3] = state[1][2];
+	state[1][2] = state[1][1];
+	state[1][1] = state[1][0];
+	state[1][0] = temp;
+
+	//Row 3, shifting by two is its own inverse
+	temp = state[2][0];
+	state[2][0] = state[2][2];
+	state[2][2] = temp;
+	temp = state[2][1];
+	state[2][1] = state[2][3];
+	state[2][3] = temp;
+
+	//Row 4
+	temp = state[3][0];
+	state[3][0] = state[3][1];
+	state[3][1] = state[3][2];
+	state[3][2] = state[3][3];
+	state[3][3] = temp;
+}
+
+/* Multiply two bytes in Rijndael's Galois field (the russian peasant method) */
+unsigned char gmul(unsigned char a, unsigned char b){
+	unsigned char p = 0;
+	while(b){
+		if(b & 1){
+			p ^= a;
+		}
+		a = (unsigned char) ((a << 1) ^ (a & 0x80 ? 0x1b : 0));
+		b >>= 1;
+	}
+	return p;
+}
+
+/* Inverse mix columns, multiplying each column by the inverse matrix [14 11 13 9] */
+void invMixColumns(unsigned char** state){
+	unsigned char a[4];
+	for(int i = 0; i < 4; ++i){
+		for(int j = 0; j < 4; ++j){
+			a[j] = state[j][i];
+		}
+		state[0][i] = gmul(a[0], 14) ^ gmul(a[1], 11) ^ gmul(a[2], 13) ^ gmul(a[3], 9);
+		state[1][i] = gmul(a[0], 9) ^ gmul(a[1], 14) ^ gmul(a[2], 11) ^ gmul(a[3], 13);
+		state[2][i] = gmul(a[0], 13) ^ gmul(a[1], 9) ^ gmul(a[2], 14) ^ gmul(a[3], 11);
+		state[3][i] = gmul(a[0], 11) ^ gmul(a[1], 13) ^ gmul(a[2], 9) ^ gmul(a[3], 14);
+	}
+}
+
+#ifdef HAVE_AESNI_PATH
+/* AES-NI version of the rounds. The 11 round keys are loaded into registers once per call and 8 blocks are
+   in flight at a time, which hides the latency of AESENC. With feed_forward set every output block is XORed
+   with its input block, giving the fixed-key hash pi(x) ^ x without a second pass.
+   Only called when the cpu reports the instruction */
+__attribute__((target("aes,sse2")))
+void encryptBlocksAesni(const unsigned char* in, unsigned char* out, long n, const unsigned char* expanded_key, int feed_forward){
+	__m128i rk[11];
+	for(int r = 0; r < 11; ++r){
+		rk[r] = _mm_loadu_si128((const __m128i*) (expanded_key + 16*r));
+	}
+	while(n >= 8){
+		//the eight lanes are spelled out so that the states stay in registers next to the round keys
+		__m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in)), rk[0]);
+		__m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 16)), rk[0]);
+		__m128i s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 32)), rk[0]);
+		__m128i s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 48)), rk[0]);
+		__m128i s4 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 64)), rk[0]);
+		__m128i s5 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 80)), rk[0]);
+		__m128i s6 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 96)), rk[0]);
+		__m128i s7 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 112)), rk[0]);
+#pragma GCC unroll 9
+		for(int r = 1; r < 10; ++r){
+			__m128i k = rk[r];
+			s0 = _mm_aesenc_si128(s0, k);
+			s1 = _mm_aesenc_si128(s1, k);
+			s2 = _mm_aesenc_si128(s2, k);
+			s3 = _mm_aesenc_si128(s3, k);
+			s4 = _mm_aesenc_si128(s4, k);
+			s5 = _mm_aesenc_si128(s5, k);
+			s6 = _mm_aesenc_si128(s6, k);
+			s7 = _mm_aesenc_si128(s7, k);
+		}
+		s0 = _mm_aesenclast_si128(s0, rk[10]);
+		s1 = _mm_aesenclast_si128(s1, rk[10]);
+		s2 = _mm_aesenclast_si128(s2, rk[10]);
+		s3 = _mm_aesenclast_si128(s3, rk[10]);
+		s4 = _mm_aesenclast_si128(s4, rk[10]);
+		s5 = _mm_aesenclast_si128(s5, rk[10]);
+		s6 = _mm_aesenclast_si128(s6, rk[10]);
+		s7 = _mm_aesenclast_si128(s7, rk[10]);
+		if(feed_forward){
+			//reload the inputs rather than keep them live through the rounds
+			s0 = _mm_xor_si128(s0, _mm_loadu_si128((const __m128i*) (in)));
+			s1 = _mm_xor_si128(s1, _mm_loadu_si128((const __m128i*) (in + 16)));
+			s2 = _mm_xor_si128(s2, _mm_loadu_si128((const __m128i*) (in + 32)));
+			s3 = _mm_xor_si128(s3, _mm_loadu_si128((const __m128i*) (in + 48)));
+			s4 = _mm_xor_si128(s4, _mm_loadu_si128((const __m128i*) (in + 64)));
+			s5 = _mm_xor_si128(s5, _mm_loadu_si128((const __m128i*) (in + 80)));
+			s6 = _mm_xor_si128(s6, _mm_loadu_si128((const __m128i*) (in + 96)));
+			s7 = _mm_xor_si128(s7, _mm_loadu_si128((const __m128i*) (in + 112)));
+		}
+		_mm_storeu_si128((__m128i*) (out), s0);
+		_mm_storeu_si128((__m128i*) (out + 16), s1);
+		_mm_storeu_si128((__m128i*) (out + 32), s2);
+		_mm_storeu_si128((__m128i*) (out + 48), s3);
+		_mm_storeu_si128((__m128i*) (out + 64), s4);
+		_mm_storeu_si128((__m128i*) (out + 80), s5);
+		_mm_storeu_si128((__m128i*) (out + 96), s6);
+		_mm_storeu_si128((__m128i*) (out + 112), s7);
+		in += 128;
+		out += 128;
+		n -= 8;
+	}
+	while(n > 0){
+		__m128i x = _mm_loadu_si128((const __m128i*) in);
+		__m128i s = _mm_xor_si128(x, rk[0]);
+		for(int r = 1; r < 10; ++r){
+			s = _mm_aesenc_si128(s, rk[r]);
+		}
+		s = _mm_aesenclast_si128(s, rk[10]);
+		if(feed_forward){
+			s = _mm_xor_si128(s, x);
+		}
+		_mm_storeu_si128((__m128i*) out, s);
+		in += 16;
+		out += 16;
+		n--;
+	}
+}
+
+/* AES-NI version of the inverse rounds, with the equivalent inverse cipher of FIPS-197 section 5.3.5: AESDEC
+   expects the middle round keys run through InvMixColumns, which AESIMC does once per call.
+   Only called when the cpu reports the instruction */
+__attribute__((target("aes,sse2")))
+void decryptBlocksAesni(const unsigned char* in, unsigned char* out, long n, const unsigned char* expanded_key){
+	__m128i dk[11];
+	dk[0] = _mm_loadu_si128((const __m128i*) (expanded_key + 160));
+	for(int r = 1; r < 10; ++r){
+		dk[r] = _mm_aesimc_si128(_mm_loadu_si128((const __m128i*) (expanded_key + 16*(10 - r))));
+	}
+	dk[10] = _mm_loadu_si128((const __m128i*) expanded_key);
+	while(n >= 8){
+		__m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in)), dk[0]);
+		__m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 16)), dk[0]);
+		__m128i s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 32)), dk[0]);
+		__m128i s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 48)), dk[0]);
+		__m128i s4 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 64)), dk[0]);
+		__m128i s5 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 80)), dk[0]);
+		__m128i s6 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 96)), dk[0]);
+		__m128i s7 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 112)), dk[0]);
+#pragma GCC unroll 9
+		for(int r = 1; r < 10; ++r){
+			__m128i k = dk[r];
+			s0 = _mm_aesdec_si128(s0, k);
+			s1 = _mm_aesdec_si128(s1, k);
+			s2 = _mm_aesdec_si128(s2, k);
+			s3 = _mm_aesdec_si128(s3, k);
+			s4 = _mm_aesdec_si128(s4, k);
+			s5 = _mm_aesdec_si128(s5, k);
+			s6 = _mm_aesdec_si128(s6, k);
+			s7 = _mm_aesdec_si128(s7, k);
+		}
+		_mm_storeu_si128((__m128i*) (out), _mm_aesdeclast_si128(s0, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 16), _mm_aesdeclast_si128(s1, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 32), _mm_aesdeclast_si128(s2, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 48), _mm_aesdeclast_si128(s3, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 64), _mm_aesdeclast_si128(s4, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 80), _mm_aesdeclast_si128(s5, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 96), _mm_aesdeclast_si128(s6, dk[10]));
+		_mm_storeu_si128((__m128i*) (out + 112), _mm_aesdeclast_si128(s7, dk[10]));
+		in += 128;
+		out += 128;
+		n -= 8;
+	}
+	while(n > 0){
+		__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*) in), dk[0]);
+		for(int r = 1; r < 10; ++r){
+			s = _mm_aesdec_si128(s, dk[r]);
+		}
+		_mm_storeu_si128((__m128i*) out, _mm_aesdeclast_si128(s, dk[10]));
+		in += 16;
+		out += 16;
+		n--;
+	}
+}
+#endif
+
+/* Number of independent blocks that encryptBlocks pushes through the rounds side by side. Every round key is
+   populated once per round and then applied to all lanes, instead of once per block */
+#define LANES 8
+
+/* Encrypt n independent 16 byte blocks from in to out (in and out may be the same buffer).
+   The blocks are processed LANES at a time, round by round, so that callers with parallel work
+   (CFB decryption, CTR keystreams, several independent chains) share the round key setup.
+   When the cpu has AES-NI the whole call goes to encryptBlocksAesni instead */
+void encryptBlocks(const unsigned char* in, unsigned char* out, int n, unsigned char* expanded_key){
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni){
+		encryptBlocksAesni(in, out, n, expanded_key, 0);
+		return;
+	}
+#endif
+	unsigned char cells[LANES][4][4]; //backing storage for the state matrix of each lane
+	unsigned char* state[LANES][4];
+	unsigned char key_cells[4][4];
+	unsigned char* round_key[4];
+	for(int l = 0; l < LANES; ++l){
+		for(int i = 0; i < 4; ++i){
+			state[l][i] = cells[l][i];
+		}
+	}
+	for(int i = 0; i < 4; ++i){
+		round_key[i] = key_cells[i];
+	}
+
+	while(n > 0){
+		int lanes = n < LANES ? n : LANES;
+		for(int l = 0; l < lanes; ++l){
+			populateState((unsigned char*) in + 16*l, state[l]);
+		}
+
+		//initial round
+		populateRoundKey(expanded_key, round_key, 0);
+		for(int l = 0; l < lanes; ++l){
+			addRoundKey(state[l], round_key);
+		}
+		//round 2-9
+		for(int iter = 1; iter < 10; ++iter){
+			populateRoundKey(expanded_key, round_key, iter);
+			for(int l = 0; l < lanes; ++l){
+				subBytes(state[l]);
+				shiftRows(state[l]);
+				mixColumns(state[l]);
+				addRoundKey(state[l], round_key);
+			}
+		}
+		//last round
+		populateRoundKey(expanded_key, round_key, 10);
+		for(int l = 0; l < lanes; ++l){
+			subBytes(state[l]);
+			shiftRows(state[l]);
+			addRoundKey(state[l], round_key);
+			populateOutput(out + 16*l, state[l]);
+		}
+
+		in += 16*lanes;
+		out += 16*lanes;
+		n -= lanes;
+	}
+}
+
+/* Encrypt a single 16 byte block, in and out may be the same buffer */
+void encryptBlock(const unsigned char* in, unsigned char* out, unsigned char* expanded_key){
+	encryptBlocks(in, out, 1, expanded_key);
+}
+
+/* Decrypt n independent 16 byte blocks from in to out (in and out may be the same buffer), LANES at a time
+   like encryptBlocks. The round keys are used from the last one to the first.
+   When the cpu has AES-NI the whole call goes to decryptBlocksAesni instead */
+void decryptBlocks(const unsigned char* in, unsigned char* out, int n, unsigned char* expanded_key){
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni){
+		decryptBlocksAesni(in, out, n, expanded_key);
+		return;
+	}
+#endif
+	unsigned char cells[LANES][4][4];
+	unsigned char* state[LANES][4];
+	unsigned char key_cells[4][4];
+	unsigned char* round_key[4];
+	for(int l = 0; l < LANES; ++l){
+		for(int i = 0; i < 4; ++i){
+			state[l][i] = cells[l][i];
+		}
+	}
+	for(int i = 0; i < 4; ++i){
+		round_key[i] = key_cells[i];
+	}
+
+	while(n > 0){
+		int lanes = n < LANES ? n : LANES;
+		for(int l = 0; l < lanes; ++l){
+			populateState((unsigned char*) in + 16*l, state[l]);
+		}
+
+		//undo the last round
+		populateRoundKey(expanded_key, round_key, 10);
+		for(int l = 0; l < lanes; ++l){
+			addRoundKey(state[l], round_key);
+			invShiftRows(state[l]);
+			invSubBytes(state[l]);
+		}
+		//undo round 9-2
+		for(int iter = 9; iter > 0; --iter){
+			populateRoundKey(expanded_key, round_key, iter);
+			for(int l = 0; l < lanes; ++l){
+				addRoundKey(state[l], round_key);
+				invMixColumns(state[l]);
+				invShiftRows(state[l]);
+				invSubBytes(state[l]);
+			}
+		}
+		//undo the initial round
+		populateRoundKey(expanded_key, round_key, 0);
+		for(int l = 0; l < lanes; ++l){
+			addRoundKey(state[l], round_key);
+			populateOutput(out + 16*l, state[l]);
+		}
+
+		in += 16*lanes;
+		out += 16*lanes;
+		n -= lanes;
+	}
+}
+
+/* Decrypt a single 16 byte block, in and out may be the same buffer */
+void decryptBlock(const unsigned char* in, unsigned char* out, unsigned char* expanded_key){
+	decryptBlocks(in, out, 1, expanded_key);
+}
+
+/* XOR len bytes of a and b into out */
+void xorBytes(const unsigned char* a, const unsigned char* b, unsigned char* out, int len){
+	for(int i = 0; i < len; ++i){
+		out[i] = a[i] ^ b[i];
+	}
+}
+
+/* ---------- CFB-128 ----------
+   Theory from https://en.wikipedia.org/wiki/Block_cipher_mode_of_operation#Cipher_feedback_(CFB)
+   The feedback register always holds the previous ciphertext block (the IV for the first one). Streaming
+   is byte granular: the keystream of the current block is kept around and the register is filled with
+   ciphertext bytes as they are produced, so calls may split the data at any byte offset */
+struct CFBState {
+	unsigned char* expanded_key;
+	unsigned char reg[16];       //previous ciphertext block
+	unsigned char keystream[16]; //E(reg) for the block in progress
+	int used;                    //bytes of keystream consumed, 16 means a new block is needed
+};
+
+void cfbInit(CFBState* cfb, unsigned char* expanded_key, const unsigned char* iv){
+	cfb->expanded_key = expanded_key;
 	for(int i = 0; i < 16; ++i){
-		key[i] = (unsigned char) block[i];
+		cfb->reg[i] = iv[i];
 	}
-	//The key is now stored in the key array
+	cfb->used = 16;
+}
 
-	//Now, expand the key, theory implemented from https://en.wikipedia.org/wiki/Rijndael_key_schedule#The_key_schedule
-    unsigned char expanded_key[176];
+void cfbEncrypt(CFBState* cfb, const unsigned char* in, unsigned char* out, long len){
+	for(long i = 0; i < len; ++i){
+		if(cfb->used == 16){
+			encryptBlock(cfb->reg, cfb->keystream, cfb->expanded_key);
+			cfb->used = 0;
+		}
+		out[i] = in[i] ^ cfb->keystream[cfb->used];
+		cfb->reg[cfb->used++] = out[i]; //the ciphertext is fed back
+	}
+}
 
-    //Call expandKey:
-    //expandKey(unsigned char *key, int key_size, unsigned char *expanded_key, int expanded_key_size)
-    expandKey(key, 16, expanded_key, 176);
-  
+/* Decryption only needs E(previous ciphertext), and all the ciphertext is already known,
+   so whole blocks are decrypted LANES at a time through encryptBlocks */
+void cfbDecrypt(CFBState* cfb, const unsigned char* in, unsigned char* out, long len){
+	unsigned char feed[16*LANES];
+	unsigned char keystream[16*LANES];
+	long i = 0;
+	//finish the block in progress byte by byte
+	while(i < len && cfb->used < 16){
+		unsigned char c = in[i];
+		out[i] = c ^ cfb->keystream[cfb->used];
+		cfb->reg[cfb->used++] = c;
+		++i;
+	}
+	//whole blocks: the feedback of block k is the ciphertext of block k-1
+	while(len - i >= 16){
+		long blocks = (len - i)/16;
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int b = 0; b < 16; ++b){
+			feed[b] = cfb->reg[b];
+		}
+		for(int l = 1; l < lanes; ++l){
+			for(int b = 0; b < 16; ++b){
+				feed[16*l + b] = in[i + 16*(l-1) + b];
+			}
+		}
+		encryptBlocks(feed, keystream, lanes, cfb->expanded_key);
+		for(int b = 0; b < 16; ++b){
+			cfb->reg[b] = in[i + 16*(lanes-1) + b]; //last ciphertext block becomes the new register
+		}
+		xorBytes(in + i, keystream, out + i, 16*lanes); //safe in place, feed holds copies of what it needs
+		i += 16*lanes;
+	}
+	//trailing partial block
+	while(i < len){
+		if(cfb->used == 16){
+			encryptBlock(cfb->reg, cfb->keystream, cfb->expanded_key);
+			cfb->used = 0;
+		}
+		unsigned char c = in[i];
+		out[i] = c ^ cfb->keystream[cfb->used];
+		cfb->reg[cfb->used++] = c;
+		++i;
+	}
+}
 
-    //Now, we create the state (the 4x4 matrix) and the round key (also 4x4) used in the addRoundKey step of the rounds
-    unsigned char** state;
-    //create the 4x4 state matrix
-    state = new unsigned char*[4];
-    for(int i = 0; i < 4; ++i){
-    	state[i] = new unsigned char[4];
-    }
-    //each index in state now has 4 columns
+/* ---------- OFB ----------
+   Theory from https://en.wikipedia.org/wiki/Block_cipher_mode_of_operation#Output_feedback_(OFB)
+   The keystream only depends on the key and IV, so it is generated ahead of time into a ring buffer.
+   ofbPrefetch can be called whenever the caller is idle (e.g. while waiting for a packet), and
+   ofbCrypt then only has to XOR. If the ring runs dry, ofbCrypt refills it itself */
+#define OFB_RING_BLOCKS 256 //4 KiB of keystream
 
-    //create a round key using the same technique as above
-    unsigned char** round_key;
-    round_key = new unsigned char*[4];
-    for(int i = 0; i < 4; ++i){
-    	round_key[i] = new unsigned char[4];
-    }
+struct OFBState {
+	unsigned char* expanded_key;
+	unsigned char feedback[16];                 //last keystream block generated
+	unsigned char ring[16*OFB_RING_BLOCKS];
+	long head;                                  //next keystream byte to hand out
+	long tail;                                  //one past the last keystream byte generated
+};
 
-    //now we have finished the initial operations on the key, we will now read the data and implement the encryption
-    unsigned char *to_encrypt;
-    to_encrypt = new unsigned char[16]; //plaintext comes in blocks of 16 bytes
-    while(cin.read(block,16)){
-    	for(int i = 0; i < 16; ++i){
-    		to_encrypt[i] = (unsigned char) block[i]; //cast data to byte size
+void ofbInit(OFBState* ofb, unsigned char* expanded_key, const unsigned char* iv){
+	ofb->expanded_key = expanded_key;
+	for(int i = 0; i < 16; ++i){
+		ofb->feedback[i] = iv[i];
+	}
+	ofb->head = 0;
+	ofb->tail = 0;
+}
 
-    	}
+/* Generate up to max_blocks keystream blocks into the free part of the ring, returns how many were made */
+int ofbPrefetch(OFBState* ofb, int max_blocks){
+	int made = 0;
+	//head and tail only grow, the ring position is the value modulo the ring size.
+	//tail stays block aligned, so a block never wraps around the end of the ring
+	while(made < max_blocks && ofb->tail - ofb->head <= 16*(OFB_RING_BLOCKS - 1)){
+		unsigned char* slot = ofb->ring + (ofb->tail % (16*OFB_RING_BLOCKS));
+		encryptBlock(ofb->feedback, slot, ofb->expanded_key);
+		for(int i = 0; i < 16; ++i){
+			ofb->feedback[i] = slot[i];
+		}
+		ofb->tail += 16;
+		made++;
+	}
+	return made;
+}
+
+/* Encrypt or decrypt len bytes (OFB is its own inverse), in and out may be the same buffer */
+void ofbCrypt(OFBState* ofb, const unsigned char* in, unsigned char* out, long len){
+	long i = 0;
+	while(i < len){
+		if(ofb->head == ofb->tail){
+			ofbPrefetch(ofb, OFB_RING_BLOCKS);
+		}
+		long pos = ofb->head % (16*OFB_RING_BLOCKS);
+		long run = ofb->tail - ofb->head;
+		if(run > 16*OFB_RING_BLOCKS - pos){
+			run = 16*OFB_RING_BLOCKS - pos; //stop at the end of the ring
+		}
+		if(run > len - i){
+			run = len - i;
+		}
+		xorBytes(in + i, ofb->ring + pos, out + i, (int) run);
+		ofb->head += run;
+		i += run;
+	}
+}
 
-    	//run initial round: AddRoundKey
-    	
-    	populateState(to_encrypt, state);
-    	populateRoundKey(expanded_key, round_key, 0);
-    	addRoundKey(state, round_key);
+/* Compare len bytes without an early exit, so the time taken does not depend on where a mismatch is.
+   Returns 1 if equal */
+int constantTimeEqual(const unsigned char* a, const unsigned char* b, int len){
+	unsigned char diff = 0;
+	for(int i = 0; i < len; ++i){
+		diff |= a[i] ^ b[i];
+	}
+	return diff == 0;
+}
 
+/* ---------- CCM ----------
+   Theory from RFC 3610 / NIST SP 800-38C. CCM is CBC-MAC over the formatted message followed by CTR
+   encryption of the message and the tag. The CBC-MAC chain is serial, but each step is paired with the
+   independent CTR block of the same position in one encryptBlocks call, so the counter work rides along
+   with the chain. The first call handles B0, A0 and A1 together, which makes a one block message cost two calls.
+   Nonces may be 7 to 13 bytes and tags 4, 6, ..., 16 bytes */
 
-    	//first cycle done, do round 2-9:
-    	for(int iter = 1; iter < 10; ++iter){
-    		populateRoundKey(expanded_key, round_key, iter);
-    		subBytes(state);
-			shiftRows(state); 
-			mixColumns(state); //TODO
-			addRoundKey(state, round_key); 
-    	}
+/* Write the counter block A_i: flags, nonce and the counter i in the last 15 - nonce_len bytes */
+void ccmCounterBlock(unsigned char* block, const unsigned char* nonce, int nonce_len, long i){
+	int l = 15 - nonce_len;
+	block[0] = (unsigned char) (l - 1);
+	for(int b = 0; b < nonce_len; ++b){
+		block[1 + b] = nonce[b];
+	}
+	for(int b = 15; b > nonce_len; --b){
+		block[b] = (unsigned char) (i & 0xff);
+		i >>= 8;
+	}
+}
+
+/* Shared by both directions: the MAC is always over the plaintext, and the plaintext of block i is
+   known after XOR with S_i in either direction. Returns 0 on invalid parameters */
+int ccmCrypt(unsigned char* expanded_key, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag, int tag_len, int decrypt){
+	if(nonce_len < 7 || nonce_len > 13 || tag_len < 4 || tag_len > 16 || tag_len % 2 != 0 || len < 0 || ad_len < 0){
+		return 0;
+	}
+	int l = 15 - nonce_len;
+	if(l < 8 && (len >> (8*l)) != 0){
+		return 0; //the message length does not fit in the length field
+	}
 
-    	//Last round
-    	populateRoundKey(expanded_key, round_key, 10);
-    	subBytes(state);
-    	shiftRows(state);
-    	addRoundKey(state, round_key);
+	unsigned char lanes[48];   //B0 / X, A0, A1 on the way in
+	unsigned char result[48];  //X, S0, S1 on the way out
+	unsigned char s0[16];
+	unsigned char s[16];
+	unsigned char x[16];
 
-    	//Done! Now transform the state to a byte array
-    	
-    	
+	//B0: flags, nonce, message length
+	lanes[0] = (unsigned char) ((ad_len > 0 ? 0x40 : 0) | (((tag_len - 2)/2) << 3) | (l - 1));
+	for(int b = 0; b < nonce_len; ++b){
+		lanes[1 + b] = nonce[b];
+	}
+	long length = len;
+	for(int b = 15; b > nonce_len; --b){
+		lanes[b] = (unsigned char) (length & 0xff);
+		length >>= 8;
+	}
+	ccmCounterBlock(lanes + 16, nonce, nonce_len, 0);
+	ccmCounterBlock(lanes + 32, nonce, nonce_len, 1);
+	long blocks = (len + 15)/16;
+	encryptBlocks(lanes, result, blocks > 0 ? 3 : 2, expanded_key);
+	for(int b = 0; b < 16; ++b){
+		x[b] = result[b];
+		s0[b] = result[16 + b];
+		s[b] = result[32 + b];
+	}
 
-    	populateOutput(to_encrypt, state);
-    	//and print it to cout
-    	for(int i = 0; i < 16; ++i){
-    		cout << to_encrypt[i];
-    	}
-		
-    }
+	//associated data: length encoding, the data itself, zero padded to a block boundary
+	if(ad_len > 0){
+		unsigned char header[10];
+		int header_len;
+		if(ad_len < 0xff00){
+			header_len = 2;
+		}
+		else if((ad_len >> 32) == 0){
+			header[0] = 0xff;
+			header[1] = 0xfe;
+			header_len = 6;
+		}
+		else{
+			header[0] = 0xff;
+			header[1] = 0xff;
+			header_len = 10;
+		}
+		long field = ad_len;
+		for(int b = header_len - 1; b >= (header_len == 2 ? 0 : 2); --b){
+			header[b] = (unsigned char) (field & 0xff);
+			field >>= 8;
+		}
+		int pos = 0; //position inside the current MAC block
+		for(long i = 0; i < header_len + ad_len; ++i){
+			x[pos++] ^= i < header_len ? header[i] : ad[i - header_len];
+			if(pos == 16){
+				encryptBlock(x, x, expanded_key);
+				pos = 0;
+			}
+		}
+		if(pos != 0){
+			encryptBlock(x, x, expanded_key); //the zero padding leaves x unchanged
+		}
+	}
+
+	//message: S_i is ready when block i arrives, then X and S_(i+1) are computed together
+	for(long i = 1; i <= blocks; ++i){
+		long off = 16*(i - 1);
+		int n = len - off < 16 ? (int) (len - off) : 16;
+		for(int b = 0; b < n; ++b){
+			unsigned char c = in[off + b];
+			out[off + b] = c ^ s[b];
+			x[b] ^= decrypt ? out[off + b] : c;
+		}
+		for(int b = 0; b < 16; ++b){
+			lanes[b] = x[b];
+		}
+		if(i < blocks){
+			ccmCounterBlock(lanes + 16, nonce, nonce_len, i + 1);
+			encryptBlocks(lanes, result, 2, expanded_key);
+			for(int b = 0; b < 16; ++b){
+				s[b] = result[16 + b];
+			}
+		}
+		else{
+			encryptBlocks(lanes, result, 1, expanded_key);
+		}
+		for(int b = 0; b < 16; ++b){
+			x[b] = result[b];
+		}
+	}
+
+	xorBytes(x, s0, x, 16); //the tag is the MAC encrypted with S0
+	if(decrypt){
+		if(!constantTimeEqual(x, tag, tag_len)){
+			for(long i = 0; i < len; ++i){
+				out[i] = 0; //never release unauthenticated plaintext
+			}
+			return 0;
+		}
+		return 1;
+	}
+	for(int b = 0; b < tag_len; ++b){
+		tag[b] = x[b];
+	}
+	return 1;
+}
+
+/* Encrypt len bytes and write a tag_len byte tag. Returns 0 on invalid parameters */
+int ccmEncrypt(unsigned char* expanded_key, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag, int tag_len){
+	return ccmCrypt(expanded_key, nonce, nonce_len, ad, ad_len, in, out, len, tag, tag_len, 0);
+}
+
+/* Decrypt and verify. Returns 1 if the tag is valid, otherwise 0 and the output is zeroed */
+int ccmDecrypt(unsigned char* expanded_key, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, const unsigned char* tag, int tag_len){
+	return ccmCrypt(expanded_key, nonce, nonce_len, ad, ad_len, in, out, len, (unsigned char*) tag, tag_len, 1);
+}
+
+/* Multiply a block by x in GF(2^128) with the big endian convention used by CMAC, SIV and OCB */
+void doubleBlock(const unsigned char* in, unsigned char* out){
+	unsigned char carry = in[0] >> 7;
+	for(int i = 0; i < 15; ++i){
+		out[i] = (unsigned char) ((in[i] << 1) | (in[i+1] >> 7));
+	}
+	out[15] = (unsigned char) ((in[15] << 1) ^ (0x87 & (0 - carry))); //reduce by x^128 + x^7 + x^2 + x + 1
+}
+
+/* ---------- CMAC ----------
+   Theory from RFC 4493 / NIST SP 800-38B. The subkeys K1 and K2 only depend on the key, so they are derived
+   once by cmacInit and kept next to the expanded key. A single CMAC is a serial CBC chain, so cmacMany
+   runs up to LANES independent messages side by side and advances every chain by one block per
+   encryptBlocks call. When a message finishes its lane is handed to the next message in the list */
+struct CMACKey {
+	unsigned char* expanded_key;
+	unsigned char k1[16];
+	unsigned char k2[16];
+};
+
+void cmacInit(CMACKey* cmac, unsigned char* expanded_key){
+	unsigned char l[16] = {0};
+	cmac->expanded_key = expanded_key;
+	encryptBlock(l, l, expanded_key);
+	doubleBlock(l, cmac->k1);
+	doubleBlock(cmac->k1, cmac->k2);
+}
+
+/* Write block i of a message into x as the next chain input, applying the subkey and padding on the last one.
+   If xorend is given (only for messages of 16 bytes or more) it is XORed into the last 16 bytes of the message
+   on the way, which is what SIV's S2V needs */
+void cmacFeed(CMACKey* cmac, const unsigned char* msg, long len, long i, unsigned char* x, const unsigned char* xorend){
+	long blocks = len == 0 ? 1 : (len + 15)/16;
+	long off = 16*i;
+	if(xorend != NULL && off + 16 > len - 16){
+		for(long p = off > len - 16 ? off : len - 16; p < off + 16 && p < len; ++p){
+			x[p - off] ^= xorend[p - (len - 16)];
+		}
+	}
+	if(i < blocks - 1){
+		xorBytes(x, msg + off, x, 16);
+	}
+	else if(len > 0 && len % 16 == 0){
+		xorBytes(x, msg + off, x, 16);
+		xorBytes(x, cmac->k1, x, 16);
+	}
+	else{
+		int rest = (int) (len - off);
+		xorBytes(x, msg + off, x, rest);
+		x[rest] ^= 0x80;
+		xorBytes(x, cmac->k2, x, 16);
+	}
+}
+
+/* Compute the 16 byte tags of count independent messages. xorends may be NULL, otherwise it holds a 16 byte
+   value (or NULL) per message for cmacFeed */
+void cmacManyXorend(CMACKey* cmac, const unsigned char** msgs, const long* lens, const unsigned char** xorends, int count, unsigned char** tags){
+	unsigned char x[16*LANES];
+	int msg_of[LANES];  //message occupying each lane
+	long block_of[LANES]; //next block of that message
+	int active = 0;
+	int next = 0;
+	while(active > 0 || next < count){
+		//fill free lanes with new messages
+		while(active < LANES && next < count){
+			msg_of[active] = next++;
+			block_of[active] = 0;
+			for(int b = 0; b < 16; ++b){
+				x[16*active + b] = 0;
+			}
+			active++;
+		}
+		for(int l = 0; l < active; ++l){
+			cmacFeed(cmac, msgs[msg_of[l]], lens[msg_of[l]], block_of[l], x + 16*l, xorends != NULL ? xorends[msg_of[l]] : NULL);
+		}
+		encryptBlocks(x, x, active, cmac->expanded_key);
+		//retire finished chains, moving the last lane into the gap to keep the lanes packed
+		for(int l = 0; l < active; ){
+			long len = lens[msg_of[l]];
+			long blocks = len == 0 ? 1 : (len + 15)/16;
+			if(++block_of[l] < blocks){
+				++l;
+				continue;
+			}
+			for(int b = 0; b < 16; ++b){
+				tags[msg_of[l]][b] = x[16*l + b];
+			}
+			active--;
+			msg_of[l] = msg_of[active];
+			block_of[l] = block_of[active];
+			for(int b = 0; b < 16; ++b){
+				x[16*l + b] = x[16*active + b];
+			}
+		}
+	}
+}
+
+/* Compute the 16 byte tags of count independent messages */
+void cmacMany(CMACKey* cmac, const unsigned char** msgs, const long* lens, int count, unsigned char** tags){
+	cmacManyXorend(cmac, msgs, lens, NULL, count, tags);
+}
+
+/* Compute the 16 byte tag of a single message */
+void cmacMessage(CMACKey* cmac, const unsigned char* msg, long len, unsigned char* tag){
+	cmacMany(cmac, &msg, &len, 1, &tag);
+}
+
+/* ---------- AES-GCM-SIV ----------
+   Theory from RFC 8452. A per-nonce authentication key and encryption key are derived with the master key,
+   POLYVAL authenticates the associated data and the plaintext, the tag is the encrypted POLYVAL result and
+   the tag (with its top bit set) is the initial counter for the CTR pass.
+   POLYVAL works in GF(2^128) modulo x^128 + x^127 + x^126 + x^121 + 1 with little endian blocks, and
+   dot(a, b) = a * b * x^-128. Blocks are held as two 64 bit halves, lo being bytes 0-7 */
+
+/* 64x64 -> 128 bit carry-less multiplication, the portable fallback for PCLMULQDQ */
+void clmul64(uint64_t a, uint64_t b, uint64_t* lo, uint64_t* hi){
+	uint64_t l = 0;
+	uint64_t h = 0;
+	for(int i = 0; i < 64; ++i){
+		uint64_t mask = 0 - ((b >> i) & 1);
+		l ^= (a << i) & mask;
+		h ^= (i == 0 ? 0 : a >> (64 - i)) & mask;
+	}
+	*lo = l;
+	*hi = h;
+}
+
+/* Unreduced 256 bit product of two field elements, p[0] being the least significant word */
+void polyvalProduct(const uint64_t* a, const uint64_t* b, uint64_t* p){
+	uint64_t l0, h0, l1, h1, lm, hm;
+	clmul64(a[0], b[0], &l0, &h0);
+	clmul64(a[1], b[1], &l1, &h1);
+	clmul64(a[0] ^ a[1], b[0] ^ b[1], &lm, &hm); //Karatsuba middle term
+	lm ^= l0 ^ l1;
+	hm ^= h0 ^ h1;
+	p[0] = l0;
+	p[1] = h0 ^ lm;
+	p[2] = l1 ^ hm;
+	p[3] = h1;
+}
+
+/* Montgomery reduction of a 256 bit product: multiply by x^-128 and reduce modulo the POLYVAL polynomial.
+   Products are linear, so several of them may be XORed together and reduced once */
+void polyvalReduce(const uint64_t* p, uint64_t* out){
+	uint64_t v0 = p[0], v1 = p[1], v2 = p[2], v3 = p[3];
+	v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+	v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+	v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+	v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+	out[0] = v2;
+	out[1] = v3;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_PCLMUL_PATH 1
+/* Same as polyvalProduct, with PCLMULQDQ. Only called when the cpu reports the instruction */
+__attribute__((target("pclmul,sse2")))
+void polyvalProductPclmul(const uint64_t* a, const uint64_t* b, uint64_t* p){
+	__m128i x = _mm_loadu_si128((const __m128i*) a);
+	__m128i y = _mm_loadu_si128((const __m128i*) b);
+	__m128i lo = _mm_clmulepi64_si128(x, y, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(x, y, 0x11);
+	__m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(x, y, 0x01), _mm_clmulepi64_si128(x, y, 0x10));
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+	_mm_storeu_si128((__m128i*) p, lo);
+	_mm_storeu_si128((__m128i*) (p + 2), hi);
+}
+#endif
+
+/* Pick the carry-less multiply once, based on what the cpu supports */
+typedef void (*ProductFn)(const uint64_t*, const uint64_t*, uint64_t*);
+ProductFn selectPolyvalProduct(){
+#ifdef HAVE_PCLMUL_PATH
+	if(__builtin_cpu_supports("pclmul")){
+		return polyvalProductPclmul;
+	}
+#endif
+	return polyvalProduct;
+}
+ProductFn polyval_product = selectPolyvalProduct();
+
+/* Running POLYVAL state. h_pow holds H, H^2, H^3, H^4 (powers in the dot sense), so four blocks are
+   folded in with four multiplications and one reduction */
+struct Polyval {
+	uint64_t h_pow[4][2];
+	uint64_t acc[2];
+};
+
+void loadBlock64(const unsigned char* block, uint64_t* out){
+	out[0] = 0;
+	out[1] = 0;
+	for(int i = 7; i >= 0; --i){
+		out[0] = (out[0] << 8) | block[i];
+		out[1] = (out[1] << 8) | block[8 + i];
+	}
+}
+
+void storeBlock64(const uint64_t* in, unsigned char* block){
+	for(int i = 0; i < 8; ++i){
+		block[i] = (unsigned char) (in[0] >> (8*i));
+		block[8 + i] = (unsigned char) (in[1] >> (8*i));
+	}
+}
+
+void polyvalInit(Polyval* pv, const unsigned char* h){
+	uint64_t p[4];
+	loadBlock64(h, pv->h_pow[0]);
+	for(int k = 1; k < 4; ++k){
+		polyval_product(pv->h_pow[k-1], pv->h_pow[0], p);
+		polyvalReduce(p, pv->h_pow[k]);
+	}
+	pv->acc[0] = 0;
+	pv->acc[1] = 0;
+}
+
+/* Absorb whole 16 byte blocks */
+void polyvalUpdate(Polyval* pv, const unsigned char* data, long blocks){
+	uint64_t x[2], p[4], sum[4];
+	while(blocks >= 4){
+		//acc = (acc ^ X1)*H^4 ^ X2*H^3 ^ X3*H^2 ^ X4*H
+		sum[0] = sum[1] = sum[2] = sum[3] = 0;
+		for(int k = 0; k < 4; ++k){
+			loadBlock64(data + 16*k, x);
+			if(k == 0){
+				x[0] ^= pv->acc[0];
+				x[1] ^= pv->acc[1];
+			}
+			polyval_product(x, pv->h_pow[3 - k], p);
+			for(int w = 0; w < 4; ++w){
+				sum[w] ^= p[w];
+			}
+		}
+		polyvalReduce(sum, pv->acc);
+		data += 64;
+		blocks -= 4;
+	}
+	while(blocks > 0){
+		loadBlock64(data, x);
+		x[0] ^= pv->acc[0];
+		x[1] ^= pv->acc[1];
+		polyval_product(x, pv->h_pow[0], p);
+		polyvalReduce(p, pv->acc);
+		data += 16;
+		blocks--;
+	}
+}
+
+/* Absorb len bytes, zero padding the last partial block */
+void polyvalUpdatePadded(Polyval* pv, const unsigned char* data, long len){
+	polyvalUpdate(pv, data, len/16);
+	if(len % 16 != 0){
+		unsigned char last[16] = {0};
+		for(int i = 0; i < len % 16; ++i){
+			last[i] = data[16*(len/16) + i];
+		}
+		polyvalUpdate(pv, last, 1);
+	}
+}
+
+/* CTR pass of GCM-SIV: the first 32 bits of the counter block are a little endian counter that wraps */
+void gcmSivCtr(unsigned char* expanded_key, const unsigned char* initial, const unsigned char* in, unsigned char* out, long len){
+	unsigned char counters[16*LANES];
+	unsigned char keystream[16*LANES];
+	uint32_t ctr = (uint32_t) initial[0] | ((uint32_t) initial[1] << 8) | ((uint32_t) initial[2] << 16) | ((uint32_t) initial[3] << 24);
+	while(len > 0){
+		long blocks = (len + 15)/16;
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int l = 0; l < lanes; ++l){
+			for(int b = 0; b < 4; ++b){
+				counters[16*l + b] = (unsigned char) (ctr >> (8*b));
+			}
+			for(int b = 4; b < 16; ++b){
+				counters[16*l + b] = initial[b];
+			}
+			ctr++;
+		}
+		encryptBlocks(counters, keystream, lanes, expanded_key);
+		int n = len < 16*lanes ? (int) len : 16*lanes;
+		xorBytes(in, keystream, out, n);
+		in += n;
+		out += n;
+		len -= n;
+	}
+}
+
+/* One record of a GCM-SIV batch. The nonce is 12 bytes, the tag 16 */
+struct GCMSIVRecord {
+	const unsigned char* nonce;
+	const unsigned char* ad;
+	long ad_len;
+	const unsigned char* in;
+	unsigned char* out;
+	long len;
+	unsigned char* tag;
+	int ok; //set by gcmSivOpenMany: 1 if the tag was valid
+};
+
+/* Derive the message authentication key and the expanded message encryption key of every record.
+   The derivation blocks of all records go through the master key together, LANES/4 records per call */
+void gcmSivDeriveKeys(unsigned char* expanded_key, GCMSIVRecord* records, int count, unsigned char* auth_keys, unsigned char* enc_keys){
+	unsigned char blocks[16*LANES];
+	for(int r = 0; r < count; r += LANES/4){
+		int batch = count - r < LANES/4 ? count - r : LANES/4;
+		for(int k = 0; k < batch; ++k){
+			for(int i = 0; i < 4; ++i){
+				unsigned char* block = blocks + 16*(4*k + i);
+				block[0] = (unsigned char) i;
+				block[1] = block[2] = block[3] = 0;
+				for(int b = 0; b < 12; ++b){
+					block[4 + b] = records[r + k].nonce[b];
+				}
+			}
+		}
+		encryptBlocks(blocks, blocks, 4*batch, expanded_key);
+		for(int k = 0; k < batch; ++k){
+			unsigned char* d = blocks + 64*k;
+			unsigned char enc_key[16];
+			for(int b = 0; b < 8; ++b){
+				auth_keys[16*(r + k) + b] = d[b];
+				auth_keys[16*(r + k) + 8 + b] = d[16 + b];
+				enc_key[b] = d[32 + b];
+				enc_key[8 + b] = d[48 + b];
+			}
+			expandKey(enc_key, 16, enc_keys + 176*(r + k), 176);
+		}
+	}
+}
+
+/* POLYVAL the lengths block, mix in the nonce and encrypt to get the tag */
+void gcmSivFinishTag(Polyval* pv, GCMSIVRecord* rec, unsigned char* enc_key, unsigned char* tag){
+	unsigned char lengths[16];
+	uint64_t bits[2] = { (uint64_t) rec->ad_len*8, (uint64_t) rec->len*8 };
+	storeBlock64(bits, lengths);
+	polyvalUpdate(pv, lengths, 1);
+	storeBlock64(pv->acc, tag);
+	xorBytes(tag, rec->nonce, tag, 12);
+	tag[15] &= 0x7f;
+	encryptBlock(tag, tag, enc_key);
+}
+
+/* Encrypt count records. Returns 0 if a record is too long for GCM-SIV (2^36 bytes), nothing is written then */
+int gcmSivSealMany(unsigned char* expanded_key, GCMSIVRecord* records, int count){
+	if(count <= 0){
+		return 1;
+	}
+	for(int r = 0; r < count; ++r){
+		if(records[r].len > (1L << 36) || records[r].ad_len > (1L << 36)){
+			return 0;
+		}
+	}
+	unsigned char* auth_keys = new unsigned char[16*count];
+	unsigned char* enc_keys = new unsigned char[176*count];
+	gcmSivDeriveKeys(expanded_key, records, count, auth_keys, enc_keys);
+	for(int r = 0; r < count; ++r){
+		GCMSIVRecord* rec = records + r;
+		Polyval pv;
+		unsigned char counter[16];
+		polyvalInit(&pv, auth_keys + 16*r);
+		polyvalUpdatePadded(&pv, rec->ad, rec->ad_len);
+		polyvalUpdatePadded(&pv, rec->in, rec->len);
+		gcmSivFinishTag(&pv, rec, enc_keys + 176*r, rec->tag);
+		for(int b = 0; b < 16; ++b){
+			counter[b] = rec->tag[b];
+		}
+		counter[15] |= 0x80;
+		gcmSivCtr(enc_keys + 176*r, counter, rec->in, rec->out, rec->len);
+		rec->ok = 1;
+	}
+	delete[] auth_keys;
+	delete[] enc_keys;
+	return 1;
+}
+
+/* Decrypt and verify count records. Each record's ok field tells whether its tag was valid, the output of a
+   failed record is zeroed. The CTR pass and POLYVAL are stitched: every chunk of plaintext is authenticated
+   right after it is decrypted, while it is still in cache. Returns 1 if all records were valid */
+int gcmSivOpenMany(unsigned char* expanded_key, GCMSIVRecord* records, int count){
+	int all_ok = 1;
+	if(count <= 0){
+		return all_ok;
+	}
+	unsigned char* auth_keys = new unsigned char[16*count];
+	unsigned char* enc_keys = new unsigned char[176*count];
+	gcmSivDeriveKeys(expanded_key, records, count, auth_keys, enc_keys);
+	for(int r = 0; r < count; ++r){
+		GCMSIVRecord* rec = records + r;
+		Polyval pv;
+		unsigned char counter[16];
+		unsigned char expected[16];
+		polyvalInit(&pv, auth_keys + 16*r);
+		polyvalUpdatePadded(&pv, rec->ad, rec->ad_len);
+		for(int b = 0; b < 16; ++b){
+			counter[b] = rec->tag[b];
+		}
+		counter[15] |= 0x80;
+		uint32_t ctr = (uint32_t) counter[0] | ((uint32_t) counter[1] << 8) | ((uint32_t) counter[2] << 16) | ((uint32_t) counter[3] << 24);
+		for(long off = 0; off < rec->len; off += 16*LANES){
+			long n = rec->len - off < 16*LANES ? rec->len - off : 16*LANES;
+			for(int b = 0; b < 4; ++b){
+				counter[b] = (unsigned char) (ctr >> (8*b));
+			}
+			gcmSivCtr(enc_keys + 176*r, counter, rec->in + off, rec->out + off, n);
+			polyvalUpdatePadded(&pv, rec->out + off, n); //only the last chunk can be partial
+			ctr += LANES;
+		}
+		gcmSivFinishTag(&pv, rec, enc_keys + 176*r, expected);
+		rec->ok = constantTimeEqual(expected, rec->tag, 16);
+		if(!rec->ok){
+			for(long i = 0; i < rec->len; ++i){
+				rec->out[i] = 0;
+			}
+			all_ok = 0;
+		}
+	}
+	delete[] auth_keys;
+	delete[] enc_keys;
+	return all_ok;
+}
+
+/* ---------- OCB3 ----------
+   Theory from RFC 7253. Every block is whitened with an offset before and after the cipher, and the offsets only
+   depend on the nonce and the block index, so all blocks are independent in both directions. The offsets
+   L_* , L_$ and L_i (i = number of trailing zeros of the block index) are precomputed once per key in OCBKey.
+   The core processes OCB_BATCH blocks per encryptBlocks/decryptBlocks call and accumulates the plaintext
+   checksum 64 bits at a time. Nonces may be 1 to 15 bytes and tags 1 to 16 bytes */
+#define OCB_L_COUNT 32 //enough for messages of up to 2^32 blocks
+#define OCB_BATCH 8
+
+struct OCBKey {
+	unsigned char* expanded_key;
+	unsigned char l_star[16];
+	unsigned char l_dollar[16];
+	unsigned char l[OCB_L_COUNT][16];
+};
 
+void ocbInit(OCBKey* ocb, unsigned char* expanded_key){
+	unsigned char zero[16] = {0};
+	ocb->expanded_key = expanded_key;
+	encryptBlock(zero, ocb->l_star, expanded_key);
+	doubleBlock(ocb->l_star, ocb->l_dollar);
+	doubleBlock(ocb->l_dollar, ocb->l[0]);
+	for(int i = 1; i < OCB_L_COUNT; ++i){
+		doubleBlock(ocb->l[i-1], ocb->l[i]);
+	}
+}
 
+/* Number of trailing zero bits of a block index (never 0) */
+int ntz(unsigned long i){
+	int n = 0;
+	while((i & 1) == 0){
+		i >>= 1;
+		n++;
+	}
+	return n;
+}
+
+/* XOR 16*blocks bytes of src into dst, a 64 bit word at a time */
+void xorWords(unsigned char* dst, const unsigned char* src, int blocks){
+	for(int i = 0; i < 2*blocks; ++i){
+		uint64_t a, b;
+		memcpy(&a, dst + 8*i, 8);
+		memcpy(&b, src + 8*i, 8);
+		a ^= b;
+		memcpy(dst + 8*i, &a, 8);
+	}
+}
+
+/* Offset_0 from the nonce: encrypt the formatted nonce with its low 6 bits cleared and take 128 bits
+   of the stretched result, starting at the bit given by those 6 bits */
+void ocbInitialOffset(OCBKey* ocb, const unsigned char* nonce, int nonce_len, int tag_len, unsigned char* offset){
+	unsigned char formatted[16] = {0};
+	unsigned char stretch[24];
+	formatted[0] = (unsigned char) (((tag_len*8) % 128) << 1);
+	formatted[15 - nonce_len] |= 0x01;
+	for(int i = 0; i < nonce_len; ++i){
+		formatted[16 - nonce_len + i] = nonce[i];
+	}
+	int bottom = formatted[15] & 0x3f;
+	formatted[15] &= 0xc0;
+	encryptBlock(formatted, stretch, ocb->expanded_key);
+	for(int i = 0; i < 8; ++i){
+		stretch[16 + i] = stretch[i] ^ stretch[i + 1];
+	}
+	int byte_shift = bottom/8;
+	int bit_shift = bottom % 8;
+	for(int i = 0; i < 16; ++i){
+		offset[i] = stretch[i + byte_shift];
+		if(bit_shift != 0){
+			offset[i] = (unsigned char) ((offset[i] << bit_shift) | (stretch[i + byte_shift + 1] >> (8 - bit_shift)));
+		}
+	}
+}
+
+/* HASH(K, A), the sum of the encrypted associated data blocks */
+void ocbHash(OCBKey* ocb, const unsigned char* ad, long ad_len, unsigned char* sum){
+	unsigned char offset[16] = {0};
+	unsigned char x[16*OCB_BATCH];
+	long blocks = ad_len/16;
+	for(int b = 0; b < 16; ++b){
+		sum[b] = 0;
+	}
+	for(long i = 0; i < blocks; i += OCB_BATCH){
+		int batch = blocks - i < OCB_BATCH ? (int) (blocks - i) : OCB_BATCH;
+		for(int k = 0; k < batch; ++k){
+			xorBytes(offset, ocb->l[ntz(i + k + 1)], offset, 16);
+			xorBytes(ad + 16*(i + k), offset, x + 16*k, 16);
+		}
+		encryptBlocks(x, x, batch, ocb->expanded_key);
+		for(int k = 0; k < batch; ++k){
+			xorWords(sum, x + 16*k, 1);
+		}
+	}
+	int rest = (int) (ad_len % 16);
+	if(rest > 0){
+		unsigned char last[16] = {0};
+		for(int b = 0; b < rest; ++b){
+			last[b] = ad[16*blocks + b];
+		}
+		last[rest] = 0x80;
+		xorBytes(offset, ocb->l_star, offset, 16);
+		xorBytes(last, offset, last, 16);
+		encryptBlock(last, last, ocb->expanded_key);
+		xorWords(sum, last, 1);
+	}
+}
+
+/* Both directions, the checksum is always over the plaintext. Returns 0 on invalid parameters or,
+   when decrypting, a tag mismatch (the output is zeroed then) */
+int ocbCrypt(OCBKey* ocb, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag, int tag_len, int decrypt){
+	if(nonce_len < 1 || nonce_len > 15 || tag_len < 1 || tag_len > 16 || len < 0 || ad_len < 0
+		|| (len/16) >> OCB_L_COUNT != 0 || (ad_len/16) >> OCB_L_COUNT != 0){
+		return 0;
+	}
+	unsigned char offset[16];
+	unsigned char checksum[16] = {0};
+	unsigned char offsets[16*OCB_BATCH];
+	unsigned char x[16*OCB_BATCH];
+	unsigned char full[16];
+	ocbInitialOffset(ocb, nonce, nonce_len, tag_len, offset);
+
+	long blocks = len/16;
+	for(long i = 0; i < blocks; i += OCB_BATCH){
+		int batch = blocks - i < OCB_BATCH ? (int) (blocks - i) : OCB_BATCH;
+		for(int k = 0; k < batch; ++k){
+			xorBytes(offset, ocb->l[ntz(i + k + 1)], offset, 16);
+			for(int b = 0; b < 16; ++b){
+				offsets[16*k + b] = offset[b];
+			}
+		}
+		const unsigned char* src = in + 16*i;
+		unsigned char* dst = out + 16*i;
+		xorBytes(src, offsets, x, 16*batch);
+		if(decrypt){
+			decryptBlocks(x, x, batch, ocb->expanded_key);
+			xorBytes(x, offsets, dst, 16*batch);
+			for(int k = 0; k < batch; ++k){
+				xorWords(checksum, dst + 16*k, 1);
+			}
+		}
+		else{
+			for(int k = 0; k < batch; ++k){
+				xorWords(checksum, src + 16*k, 1); //before dst is written, in case in == out
+			}
+			encryptBlocks(x, x, batch, ocb->expanded_key);
+			xorBytes(x, offsets, dst, 16*batch);
+		}
+	}
+
+	int rest = (int) (len % 16);
+	if(rest > 0){
+		unsigned char pad[16];
+		xorBytes(offset, ocb->l_star, offset, 16);
+		encryptBlock(offset, pad, ocb->expanded_key);
+		for(int b = 0; b < 16; ++b){
+			full[b] = 0;
+		}
+		for(int b = 0; b < rest; ++b){
+			unsigned char c = in[16*blocks + b];
+			out[16*blocks + b] = c ^ pad[b];
+			full[b] = decrypt ? out[16*blocks + b] : c;
+		}
+		full[rest] = 0x80;
+		xorWords(checksum, full, 1);
+	}
+
+	//Tag = E(Checksum ^ Offset ^ L_$) ^ HASH(K, A)
+	unsigned char sum[16];
+	xorBytes(checksum, offset, full, 16);
+	xorBytes(full, ocb->l_dollar, full, 16);
+	encryptBlock(full, full, ocb->expanded_key);
+	ocbHash(ocb, ad, ad_len, sum);
+	xorBytes(full, sum, full, 16);
+
+	if(decrypt){
+		if(!constantTimeEqual(full, tag, tag_len)){
+			for(long i = 0; i < len; ++i){
+				out[i] = 0;
+			}
+			return 0;
+		}
+		return 1;
+	}
+	for(int b = 0; b < tag_len; ++b){
+		tag[b] = full[b];
+	}
+	return 1;
+}
+
+/* Encrypt len bytes and write a tag_len byte tag. Returns 0 on invalid parameters */
+int ocbEncrypt(OCBKey* ocb, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag, int tag_len){
+	return ocbCrypt(ocb, nonce, nonce_len, ad, ad_len, in, out, len, tag, tag_len, 0);
+}
+
+/* Decrypt and verify. Returns 1 if the tag is valid, otherwise 0 and the output is zeroed */
+int ocbDecrypt(OCBKey* ocb, const unsigned char* nonce, int nonce_len, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, const unsigned char* tag, int tag_len){
+	return ocbCrypt(ocb, nonce, nonce_len, ad, ad_len, in, out, len, (unsigned char*) tag, tag_len, 1);
+}
+
+/* ---------- Key wrap ----------
+   Theory from RFC 3394 (KW) and RFC 5649 (KWP, with padding). Wrapping n 64 bit blocks takes 6*n cipher
+   calls, each depending on the previous one through A. Many independent jobs are therefore driven side by
+   side: every encryptBlocks/decryptBlocks call advances up to LANES jobs by one step, and a finished job's
+   lane is given to the next job in the list */
+struct KeyWrapJob {
+	const unsigned char* in;
+	long in_len;
+	unsigned char* out;   //wrap: room for the padded input + 8 bytes, unwrap: room for in_len - 8 bytes
+	long out_len;         //set by the call
+	int padded;           //1 for KWP (RFC 5649), 0 for KW (RFC 3394)
+	int ok;               //set by the call, 0 if the input was malformed or failed the integrity check
+};
+
+unsigned char kw_iv[8] = {0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6};
+unsigned char kwp_iv[4] = {0xa6, 0x59, 0x59, 0xa6};
+
+/* Check the input and set up A and R of a job. Returns the number of 64 bit blocks in R, 0 if the job is
+   invalid and -1 if it was completed on the spot (KWP with a single block is just one ECB block) */
+long keyWrapStart(unsigned char* expanded_key, KeyWrapJob* job, unsigned char* a, int unwrap){
+	job->ok = 0;
+	job->out_len = 0;
+	if(!unwrap){
+		long min_len = job->padded ? 1 : 16;
+		if(job->in_len < min_len || (!job->padded && job->in_len % 8 != 0)){
+			return 0;
+		}
+		long padded_len = (job->in_len + 7)/8*8;
+		if(job->padded){
+			for(int b = 0; b < 4; ++b){
+				a[b] = kwp_iv[b];
+				a[4 + b] = (unsigned char) (job->in_len >> (8*(3 - b))); //message length indicator
+			}
+		}
+		else{
+			for(int b = 0; b < 8; ++b){
+				a[b] = kw_iv[b];
+			}
+		}
+		for(long b = 0; b < padded_len; ++b){
+			job->out[8 + b] = b < job->in_len ? job->in[b] : 0;
+		}
+		job->out_len = padded_len + 8;
+		if(padded_len == 8){
+			for(int b = 0; b < 8; ++b){
+				job->out[b] = a[b];
+			}
+			encryptBlock(job->out, job->out, expanded_key);
+			job->ok = 1;
+			return -1;
+		}
+		return padded_len/8;
+	}
+
+	if(job->in_len % 8 != 0 || job->in_len < (job->padded ? 16 : 24)){
+		return 0;
+	}
+	if(job->in_len == 16){
+		unsigned char block[16];
+		decryptBlock(job->in, block, expanded_key);
+		for(int b = 0; b < 8; ++b){
+			a[b] = block[b];
+			job->out[b] = block[8 + b];
+		}
+		return -1;
+	}
+	for(int b = 0; b < 8; ++b){
+		a[b] = job->in[b];
+	}
+	for(long b = 8; b < job->in_len; ++b){
+		job->out[b - 8] = job->in[b];
+	}
+	return job->in_len/8 - 1;
+}
+
+/* Check A after unwrapping, and for KWP the length indicator and the zero padding */
+void keyUnwrapFinish(KeyWrapJob* job, const unsigned char* a){
+	long r_len = job->in_len - 8;
+	if(!job->padded){
+		job->ok = constantTimeEqual(a, kw_iv, 8);
+		job->out_len = job->ok ? r_len : 0;
+		return;
+	}
+	long mli = ((long) a[4] << 24) | ((long) a[5] << 16) | ((long) a[6] << 8) | (long) a[7];
+	int ok = constantTimeEqual(a, kwp_iv, 4) && mli > r_len - 8 && mli <= r_len;
+	if(ok){
+		unsigned char nonzero = 0;
+		for(long b = mli; b < r_len; ++b){
+			nonzero |= job->out[b];
+		}
+		ok = nonzero == 0;
+	}
+	job->ok = ok;
+	job->out_len = ok ? mli : 0;
+}
+
+void keyWrapDrive(unsigned char* expanded_key, KeyWrapJob* jobs, int count, int unwrap){
+	unsigned char blocks[16*LANES];
+	unsigned char a[LANES][8];
+	int job_of[LANES];
+	long n_of[LANES];
+	long step_of[LANES];
+	int active = 0;
+	int next = 0;
+	while(active > 0 || next < count){
+		while(active < LANES && next < count){
+			KeyWrapJob* job = jobs + next;
+			long n = keyWrapStart(expanded_key, job, a[active], unwrap);
+			if(n == -1 && unwrap){
+				keyUnwrapFinish(job, a[active]);
+			}
+			if(n > 0){
+				job_of[active] = next;
+				n_of[active] = n;
+				step_of[active] = 0;
+				active++;
+			}
+			next++;
+		}
+		if(active == 0){
+			break;
+		}
+
+		//build B = A || R[i] (wrap) or (A ^ t) || R[i] (unwrap) for every lane
+		for(int l = 0; l < active; ++l){
+			long n = n_of[l];
+			long s = unwrap ? 6*n - 1 - step_of[l] : step_of[l];
+			long i = s % n;
+			unsigned char* r = jobs[job_of[l]].out + (unwrap ? 0 : 8) + 8*i;
+			unsigned long t = (unsigned long) s + 1;
+			for(int b = 0; b < 8; ++b){
+				blocks[16*l + b] = a[l][b] ^ (unwrap ? (unsigned char) (t >> (8*(7 - b))) : 0);
+				blocks[16*l + 8 + b] = r[b];
+			}
+		}
+		if(unwrap){
+			decryptBlocks(blocks, blocks, active, expanded_key);
+		}
+		else{
+			encryptBlocks(blocks, blocks, active, expanded_key);
+		}
+		for(int l = 0; l < active; ++l){
+			long n = n_of[l];
+			long s = unwrap ? 6*n - 1 - step_of[l] : step_of[l];
+			unsigned char* r = jobs[job_of[l]].out + (unwrap ? 0 : 8) + 8*(s % n);
+			unsigned long t = (unsigned long) s + 1;
+			for(int b = 0; b < 8; ++b){
+				a[l][b] = blocks[16*l + b] ^ (unwrap ? 0 : (unsigned char) (t >> (8*(7 - b))));
+				r[b] = blocks[16*l + 8 + b];
+			}
+		}
+
+		//retire finished jobs, moving the last lane into the gap
+		for(int l = 0; l < active; ){
+			if(++step_of[l] < 6*n_of[l]){
+				++l;
+				continue;
+			}
+			KeyWrapJob* job = jobs + job_of[l];
+			if(unwrap){
+				keyUnwrapFinish(job, a[l]);
+			}
+			else{
+				for(int b = 0; b < 8; ++b){
+					job->out[b] = a[l][b];
+				}
+				job->ok = 1;
+			}
+			active--;
+			job_of[l] = job_of[active];
+			n_of[l] = n_of[active];
+			step_of[l] = step_of[active];
+			for(int b = 0; b < 8; ++b){
+				a[l][b] = a[active][b];
+			}
+		}
+	}
+	if(unwrap){
+		for(int j = 0; j < count; ++j){
+			if(!jobs[j].ok && jobs[j].in_len >= 8){
+				for(long b = 0; b < jobs[j].in_len - 8; ++b){
+					jobs[j].out[b] = 0; //never release an unverified key
+				}
+			}
+		}
+	}
+}
+
+/* Wrap count keys, each job's ok field tells whether it succeeded */
+void keyWrapMany(unsigned char* expanded_key, KeyWrapJob* jobs, int count){
+	keyWrapDrive(expanded_key, jobs, count, 0);
+}
+
+/* Unwrap and verify count wrapped keys */
+void keyUnwrapMany(unsigned char* expanded_key, KeyWrapJob* jobs, int count){
+	keyWrapDrive(expanded_key, jobs, count, 1);
+}
+
+/* ---------- CTR_DRBG ----------
+   Theory from NIST SP 800-90A section 10.2.1, with AES-128 and no derivation function, so the seed material
+   is 32 bytes of full entropy (key || V). Generate runs the counter blocks through encryptBlocks LANES at a time.
+   drbgRead hands out bytes from an internal buffer that is refilled with one maximum size (64 KiB) Generate
+   call at a time, and drbgThreadBytes keeps one instance per thread so the generate path needs no lock */
+#define DRBG_SEED_LEN 32
+#define DRBG_MAX_REQUEST 65536              //2^19 bits, the largest Generate request allowed for AES
+#define DRBG_RESEED_INTERVAL (1L << 32)     //Generate calls between reseeds, SP 800-90A allows up to 2^48
+
+struct CTRDRBG {
+	unsigned char expanded_key[176];
+	unsigned char v[16];
+	long reseed_counter;
+	unsigned char buffer[DRBG_MAX_REQUEST];
+	long buffer_pos; //next unused byte of buffer, DRBG_MAX_REQUEST when empty
+};
+
+/* V = (V + 1) mod 2^128 */
+void incrementBlock(unsigned char* v){
+	for(int i = 15; i >= 0; --i){
+		if(++v[i] != 0){
+			break;
+		}
+	}
+}
+
+/* CTR_DRBG_Update: derive a new key and V from the old ones and 32 bytes of provided data (NULL means zeros) */
+void drbgUpdate(CTRDRBG* drbg, const unsigned char* provided){
+	unsigned char temp[DRBG_SEED_LEN];
+	for(int i = 0; i < DRBG_SEED_LEN; i += 16){
+		incrementBlock(drbg->v);
+		for(int b = 0; b < 16; ++b){
+			temp[i + b] = drbg->v[b];
+		}
+	}
+	encryptBlocks(temp, temp, DRBG_SEED_LEN/16, drbg->expanded_key);
+	if(provided != NULL){
+		xorBytes(temp, provided, temp, DRBG_SEED_LEN);
+	}
+	expandKey(temp, 16, drbg->expanded_key, 176);
+	for(int b = 0; b < 16; ++b){
+		drbg->v[b] = temp[16 + b];
+	}
+}
+
+/* XOR up to DRBG_SEED_LEN bytes of extra input into the seed material */
+void drbgSeedMaterial(const unsigned char* entropy, const unsigned char* extra, int extra_len, unsigned char* seed){
+	for(int b = 0; b < DRBG_SEED_LEN; ++b){
+		seed[b] = entropy[b] ^ (b < extra_len ? extra[b] : 0);
+	}
+}
+
+/* Instantiate from 32 bytes of entropy and an optional personalization string of up to 32 bytes. Returns 0 if
+   the personalization string is longer, which SP 800-90A does not allow without a derivation function */
+int drbgInstantiate(CTRDRBG* drbg, const unsigned char* entropy, const unsigned char* personalization, int pers_len){
+	unsigned char seed[DRBG_SEED_LEN];
+	unsigned char zero_key[16] = {0};
+	if(pers_len < 0 || pers_len > DRBG_SEED_LEN){
+		return 0;
+	}
+	drbgSeedMaterial(entropy, personalization, pers_len, seed);
+	expandKey(zero_key, 16, drbg->expanded_key, 176);
+	for(int b = 0; b < 16; ++b){
+		drbg->v[b] = 0;
+	}
+	drbgUpdate(drbg, seed);
+	drbg->reseed_counter = 1;
+	drbg->buffer_pos = DRBG_MAX_REQUEST;
+	return 1;
+}
+
+/* Reseed from 32 bytes of fresh entropy and optional additional input of up to 32 bytes. Buffered output
+   from before the reseed is discarded. Returns 0, leaving the state alone, if the additional input is longer */
+int drbgReseed(CTRDRBG* drbg, const unsigned char* entropy, const unsigned char* additional, int add_len){
+	unsigned char seed[DRBG_SEED_LEN];
+	if(add_len < 0 || add_len > DRBG_SEED_LEN){
+		return 0;
+	}
+	drbgSeedMaterial(entropy, additional, add_len, seed);
+	drbgUpdate(drbg, seed);
+	drbg->reseed_counter = 1;
+	drbg->buffer_pos = DRBG_MAX_REQUEST;
+	return 1;
+}
+
+/* One SP 800-90A Generate call of up to DRBG_MAX_REQUEST bytes with optional additional input of up to 32 bytes.
+   Returns 0 if a reseed is required first, the request is too large or the additional input is too long */
+int drbgGenerate(CTRDRBG* drbg, unsigned char* out, long len, const unsigned char* additional, int add_len){
+	unsigned char counters[16*LANES];
+	unsigned char extra[DRBG_SEED_LEN];
+	if(drbg->reseed_counter > DRBG_RESEED_INTERVAL || len > DRBG_MAX_REQUEST || len < 0){
+		return 0;
+	}
+	if(add_len < 0 || add_len > DRBG_SEED_LEN){
+		return 0;
+	}
+	if(add_len > 0){
+		for(int b = 0; b < DRBG_SEED_LEN; ++b){
+			extra[b] = b < add_len ? additional[b] : 0;
+		}
+		drbgUpdate(drbg, extra);
+	}
+	while(len > 0){
+		long blocks = (len + 15)/16;
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int l = 0; l < lanes; ++l){
+			incrementBlock(drbg->v);
+			for(int b = 0; b < 16; ++b){
+				counters[16*l + b] = drbg->v[b];
+			}
+		}
+		if(len >= 16*lanes){
+			encryptBlocks(counters, out, lanes, drbg->expanded_key); //straight into the output
+			out += 16*lanes;
+			len -= 16*lanes;
+		}
+		else{
+			encryptBlocks(counters, counters, lanes, drbg->expanded_key);
+			for(long b = 0; b < len; ++b){
+				out[b] = counters[b];
+			}
+			len = 0;
+		}
+	}
+	drbgUpdate(drbg, add_len > 0 ? extra : NULL);
+	drbg->reseed_counter++;
+	return 1;
+}
+
+/* Read len bytes through the internal buffer. Returns 0 if a reseed is required first */
+int drbgRead(CTRDRBG* drbg, unsigned char* out, long len){
+	while(len > 0){
+		if(drbg->buffer_pos == DRBG_MAX_REQUEST){
+			if(len >= DRBG_MAX_REQUEST){
+				//large reads bypass the buffer
+				if(!drbgGenerate(drbg, out, DRBG_MAX_REQUEST, NULL, 0)){
+					return 0;
+				}
+				out += DRBG_MAX_REQUEST;
+				len -= DRBG_MAX_REQUEST;
+				continue;
+			}
+			if(!drbgGenerate(drbg, drbg->buffer, DRBG_MAX_REQUEST, NULL, 0)){
+				return 0;
+			}
+			drbg->buffer_pos = 0;
+		}
+		long n = DRBG_MAX_REQUEST - drbg->buffer_pos;
+		if(n > len){
+			n = len;
+		}
+		memcpy(out, drbg->buffer + drbg->buffer_pos, n);
+		memset(drbg->buffer + drbg->buffer_pos, 0, n); //handed out bytes are not kept around
+		drbg->buffer_pos += n;
+		out += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* CTR_DRBG_Uninstantiate: wipe the internal state, through a volatile pointer so the stores are not dropped */
+void drbgUninstantiate(CTRDRBG* drbg){
+	volatile unsigned char* p = (volatile unsigned char*) drbg;
+	for(size_t i = 0; i < sizeof(CTRDRBG); ++i){
+		p[i] = 0;
+	}
+}
+
+/* Fill buf with len bytes from the operating system. Returns 0 on failure */
+int systemEntropy(unsigned char* buf, long len){
+	FILE* f = fopen("/dev/urandom", "rb");
+	if(f == NULL){
+		return 0;
+	}
+	long got = (long) fread(buf, 1, len, f);
+	fclose(f);
+	return got == len;
+}
+
+/* A thread's CTR_DRBG, uninstantiated and freed when the thread exits */
+struct ThreadDRBG {
+	CTRDRBG* drbg;
+	~ThreadDRBG(){
+		if(drbg != NULL){
+			drbgUninstantiate(drbg);
+			delete drbg;
+		}
+	}
+};
+
+/* Random bytes from this thread's own CTR_DRBG, instantiated and reseeded from the operating system as needed.
+   Returns 0 if no entropy could be obtained */
+int drbgThreadBytes(unsigned char* out, long len){
+	static thread_local ThreadDRBG instance = { NULL };
+	CTRDRBG*& drbg = instance.drbg;
+	unsigned char entropy[DRBG_SEED_LEN];
+	if(drbg == NULL){
+		if(!systemEntropy(entropy, DRBG_SEED_LEN)){
+			return 0;
+		}
+		drbg = new CTRDRBG;
+		drbgInstantiate(drbg, entropy, NULL, 0);
+	}
+	while(!drbgRead(drbg, out, len)){
+		if(!systemEntropy(entropy, DRBG_SEED_LEN)){
+			return 0;
+		}
+		drbgReseed(drbg, entropy, NULL, 0);
+	}
+	return 1;
+}
+
+/* ---------- Fixed-key hash ----------
+   The correlation robust hash H(x) = pi(x) ^ x, where pi is AES under a key that never changes.
+   The key is expanded once by fixedKeyHashInit, after that a call only loads the round keys and streams
+   the input through the 8-way AES-NI kernel, which XORs each input into its output as it stores it */
+struct FixedKeyHash {
+	unsigned char expanded_key[176];
+};
+
+void fixedKeyHashInit(FixedKeyHash* h, const unsigned char* key){
+	expandKey((unsigned char*) key, 16, h->expanded_key, 176);
+}
+
+/* Hash n independent 16 byte blocks, in and out may be the same buffer */
+void fixedKeyHash(FixedKeyHash* h, const unsigned char* in, unsigned char* out, long n){
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni){
+		encryptBlocksAesni(in, out, n, h->expanded_key, 1);
+		return;
+	}
+#endif
+	unsigned char permuted[16*LANES];
+	while(n > 0){
+		int lanes = n < LANES ? (int) n : LANES;
+		encryptBlocks(in, permuted, lanes, h->expanded_key);
+		xorBytes(permuted, in, out, 16*lanes);
+		in += 16*lanes;
+		out += 16*lanes;
+		n -= lanes;
+	}
+}
+
+/* Encrypt n blocks (at most LANES), block l under its own expanded key keys[l]. Used where every lane has a
+   different key, like the hash chains below */
+#ifdef HAVE_AESNI_PATH
+__attribute__((target("aes,sse2")))
+void encryptBlocksKeyedAesni(const unsigned char* in, unsigned char* out, int n, unsigned char** keys){
+	__m128i s[LANES] = {};
+#pragma GCC unroll 8
+	for(int l = 0; l < LANES; ++l){
+		if(l < n){
+			s[l] = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 16*l)), _mm_loadu_si128((const __m128i*) keys[l]));
+		}
+	}
+#pragma GCC unroll 9
+	for(int r = 1; r < 10; ++r){
+#pragma GCC unroll 8
+		for(int l = 0; l < LANES; ++l){
+			if(l < n){
+				s[l] = _mm_aesenc_si128(s[l], _mm_loadu_si128((const __m128i*) (keys[l] + 16*r)));
+			}
+		}
+	}
+#pragma GCC unroll 8
+	for(int l = 0; l < LANES; ++l){
+		if(l < n){
+			s[l] = _mm_aesenclast_si128(s[l], _mm_loadu_si128((const __m128i*) (keys[l] + 160)));
+			_mm_storeu_si128((__m128i*) (out + 16*l), s[l]);
+		}
+	}
+}
+#endif
+
+void encryptBlocksKeyed(const unsigned char* in, unsigned char* out, int n, unsigned char** keys){
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni){
+		encryptBlocksKeyedAesni(in, out, n, keys);
+		return;
+	}
+#endif
+	for(int l = 0; l < n; ++l){
+		encryptBlock(in + 16*l, out + 16*l, keys[l]);
+	}
+}
+
+/* ---------- Block cipher based hashing ----------
+   Theory from https://en.wikipedia.org/wiki/One-way_compression_function
+   Matyas-Meyer-Oseas: H_i = E_(H_i-1)(m_i) ^ m_i, the chaining value is the key.
+   Davies-Meyer:       H_i = E_(m_i)(H_i-1) ^ H_i-1, the message block is the key.
+   Both rekey every block through expandKey. The message is Merkle-Damgard padded (0x80, zeros, the 64 bit
+   length in bits) and the chain starts from a zero block.
+   The lanes variant hashes long inputs as LANES independent chains: block i goes to chain i % LANES, every step
+   advances all chains with one encryptBlocksKeyed call, and a final serial chain absorbs the chaining values
+   of the lanes, the remaining tail and the padding. It gives different digests than the serial variant */
+#define HASH_MMO 0
+#define HASH_DM 1
+
+#ifdef HAVE_AESNI_PATH
+/* AES-NI version of compressMany. The key schedule of every lane is computed on the fly, one round key ahead of
+   the rounds, so neither the expanded keys nor the states ever leave the registers. AESKEYGENASSIST is slow
+   on many cpus, so the schedule uses the PSHUFB + AESENCLAST form instead: broadcasting the rotated last word
+   to all columns makes ShiftRows a no-op, leaving SubWord ^ rcon */
+__attribute__((target("aes,ssse3")))
+void compressManyAesni(int kind, unsigned char* h, const unsigned char* m, int n){
+	__m128i k[LANES] = {};
+	__m128i x[LANES] = {};
+	__m128i s[LANES] = {};
+	__m128i rotate = _mm_set1_epi32(0x0c0f0e0d);
+	__m128i rcon = _mm_set1_epi32(1);
+#pragma GCC unroll 8
+	for(int l = 0; l < LANES; ++l){
+		if(l < n){
+			__m128i hl = _mm_loadu_si128((const __m128i*) (h + 16*l));
+			__m128i ml = _mm_loadu_si128((const __m128i*) (m + 16*l));
+			k[l] = kind == HASH_MMO ? hl : ml;
+			x[l] = kind == HASH_MMO ? ml : hl;
+			s[l] = _mm_xor_si128(x[l], k[l]);
+		}
+	}
+#pragma GCC unroll 10
+	for(int r = 1; r <= 10; ++r){
+		if(r == 9){
+			rcon = _mm_set1_epi32(0x1b);
+		}
+#pragma GCC unroll 8
+		for(int l = 0; l < LANES; ++l){
+			if(l < n){
+				__m128i t = _mm_aesenclast_si128(_mm_shuffle_epi8(k[l], rotate), rcon);
+				__m128i key = _mm_xor_si128(k[l], _mm_slli_si128(k[l], 4));
+				key = _mm_xor_si128(key, _mm_slli_si128(key, 8));
+				k[l] = _mm_xor_si128(key, t);
+				s[l] = r == 10 ? _mm_aesenclast_si128(s[l], k[l]) : _mm_aesenc_si128(s[l], k[l]);
+			}
+		}
+		rcon = _mm_slli_epi32(rcon, 1);
+	}
+#pragma GCC unroll 8
+	for(int l = 0; l < LANES; ++l){
+		if(l < n){
+			_mm_storeu_si128((__m128i*) (h + 16*l), _mm_xor_si128(s[l], x[l]));
+		}
+	}
+}
+#endif
+
+/* One compression step for each of n chains: h[l] = f(h[l], m[l]) */
+void compressMany(int kind, unsigned char* h, const unsigned char* m, int n){
+#ifdef HAVE_AESNI_PATH
+	if(use_aesni && __builtin_cpu_supports("ssse3")){
+		compressManyAesni(kind, h, m, n);
+		return;
+	}
+#endif
+	unsigned char expanded[LANES][176];
+	unsigned char* keys[LANES];
+	unsigned char in[16*LANES] = {0}; //lanes past n are never encrypted, but stay defined
+	unsigned char out[16*LANES];
+	for(int l = 0; l < n; ++l){
+		const unsigned char* key = kind == HASH_MMO ? h + 16*l : m + 16*l;
+		const unsigned char* data = kind == HASH_MMO ? m + 16*l : h + 16*l;
+		expandKey((unsigned char*) key, 16, expanded[l], 176);
+		keys[l] = expanded[l];
+		for(int b = 0; b < 16; ++b){
+			in[16*l + b] = data[b];
+		}
+	}
+	encryptBlocksKeyed(in, out, n, keys);
+	xorBytes(out, in, h, 16*n); //the feed forward is the cipher input in both constructions
+}
+
+/* Absorb a tail of fewer than 16 bytes plus the padding into a single chain */
+void hashFinish(int kind, unsigned char* h, const unsigned char* tail, int tail_len, unsigned long total_len){
+	unsigned char last[32] = {0};
+	for(int b = 0; b < tail_len; ++b){
+		last[b] = tail[b];
+	}
+	last[tail_len] = 0x80;
+	int blocks = tail_len < 8 ? 1 : 2; //the 8 byte length must fit after the 0x80
+	unsigned long bits = total_len*8;
+	for(int b = 0; b < 8; ++b){
+		last[16*blocks - 1 - b] = (unsigned char) (bits >> (8*b));
+	}
+	for(int i = 0; i < blocks; ++i){
+		compressMany(kind, h, last + 16*i, 1);
+	}
+}
+
+/* Serial hash of len bytes into a 16 byte digest */
+void blockHash(int kind, const unsigned char* msg, long len, unsigned char* digest){
+	for(int b = 0; b < 16; ++b){
+		digest[b] = 0;
+	}
+	long blocks = len/16;
+	for(long i = 0; i < blocks; ++i){
+		compressMany(kind, digest, msg + 16*i, 1);
+	}
+	hashFinish(kind, digest, msg + 16*blocks, (int) (len % 16), (unsigned long) len);
+}
+
+/* Multi-lane hash of len bytes into a 16 byte digest */
+void blockHashLanes(int kind, const unsigned char* msg, long len, unsigned char* digest){
+	unsigned char lanes[16*LANES] = {0};
+	long rows = len/(16*LANES);
+	for(long r = 0; r < rows; ++r){
+		compressMany(kind, lanes, msg + 16*LANES*r, LANES);
+	}
+	//final chain: the lane values, then the rest of the message
+	for(int b = 0; b < 16; ++b){
+		digest[b] = 0;
+	}
+	for(int l = 0; l < LANES; ++l){
+		compressMany(kind, digest, lanes + 16*l, 1);
+	}
+	const unsigned char* rest = msg + 16*LANES*rows;
+	long rest_len = len - 16*LANES*rows;
+	for(long i = 0; i < rest_len/16; ++i){
+		compressMany(kind, digest, rest + 16*i, 1);
+	}
+	hashFinish(kind, digest, rest + 16*(rest_len/16), (int) (rest_len % 16), (unsigned long) len);
+}
+
+/* Print the throughput of both constructions, serial and multi-lane, on the reference rounds and on AES-NI */
+void benchHash(){
+	long len = 1L << 22;
+	unsigned char* buf = new unsigned char[len];
+	unsigned char digest[16];
+	for(long i = 0; i < len; ++i){
+		buf[i] = (unsigned char) (i*131 + 7);
+	}
+	int had_aesni = use_aesni;
+	const char* kinds[2] = {"MMO", "DM"};
+	for(int engine = 0; engine < 2; ++engine){
+		use_aesni = engine == 1 ? had_aesni : 0;
+		if(engine == 1 && !had_aesni){
+			printf("aes-ni    not supported by this cpu\n");
+			break;
+		}
+		for(int kind = 0; kind < 2; ++kind){
+			for(int lanes = 0; lanes < 2; ++lanes){
+				clock_t start = clock();
+				if(lanes){
+					blockHashLanes(kind, buf, len, digest);
+				}
+				else{
+					blockHash(kind, buf, len, digest);
+				}
+				double seconds = (double) (clock() - start)/CLOCKS_PER_SEC;
+				printf("%-9s %-3s %-6s %8.1f MB/s\n", engine == 1 ? "aes-ni" : "reference", kinds[kind],
+					lanes ? "lanes" : "serial", len/seconds/1e6);
+			}
+		}
+		//the fixed-key hash over the same buffer as independent blocks, in place
+		unsigned char fixed_key[16] = {0};
+		FixedKeyHash fixed;
+		fixedKeyHashInit(&fixed, fixed_key);
+		clock_t start = clock();
+		fixedKeyHash(&fixed, buf, buf, len/16);
+		double seconds = (double) (clock() - start)/CLOCKS_PER_SEC;
+		printf("%-9s %-3s %-6s %8.1f MB/s\n", engine == 1 ? "aes-ni" : "reference", "FKH", "blocks", len/seconds/1e6);
+	}
+	use_aesni = had_aesni;
+	delete[] buf;
+}
+
+/* ---------- Format-preserving encryption ----------
+   Theory from NIST SP 800-38G Rev. 1 (FF1 and FF3-1). A numeral string in base radix is split in two halves
+   A and B which go through a Feistel network: FF1 does 10 rounds with a CBC-MAC over P || Q, FF3-1 does 8 rounds
+   with a single block under the byte reversed key. Both only need the halves as numbers (NUM_radix), so the
+   halves are kept as integers between rounds, which limits radix^ceil(n/2) to 64 bits (38 decimal digits).
+   The batch calls run the rounds of up to LANES tokens in lockstep, one encryptBlocks call per CBC-MAC step */
+#define FPE_MIN_DOMAIN 1000000 //radix^n must be at least this large
+#define FPE_MAX_TWEAK 256      //maxTlen, the longest FF1 tweak accepted
+
+struct FPEKey {
+	unsigned char expanded_key[176];  //K, used by FF1
+	unsigned char reversed_key[176];  //REVB(K), used by FF3-1
+};
+
+/* One string to encrypt or decrypt. Numerals are most significant first and must be below the radix */
+struct FPEToken {
+	const unsigned int* in;
+	unsigned int* out;
+	int n;
+	const unsigned char* tweak;  //FF3-1 always takes a 7 byte tweak
+	int tweak_len;               //at most FPE_MAX_TWEAK
+	int ok;                      //set by the call, 0 if the token was not valid for the algorithm
+};
+
+void fpeInit(FPEKey* fpe, const unsigned char* key){
+	unsigned char reversed[16];
+	for(int b = 0; b < 16; ++b){
+		reversed[b] = key[15 - b];
+	}
+	expandKey((unsigned char*) key, 16, fpe->expanded_key, 176);
+	expandKey(reversed, 16, fpe->reversed_key, 176);
+}
+
+/* radix^m, or 0 if it does not fit in 64 bits */
+uint64_t radixPower(int radix, int m){
+	unsigned __int128 p = 1;
+	for(int i = 0; i < m; ++i){
+		p *= radix;
+		if(p >> 64){
+			return 0;
+		}
+	}
+	return (uint64_t) p;
+}
+
+/* NUM_radix of count numerals, reversed reads them least significant first (FF3-1's NUM_radix(REV(X))) */
+uint64_t numRadix(const unsigned int* x, int count, int radix, int reversed){
+	uint64_t value = 0;
+	for(int i = 0; i < count; ++i){
+		value = value*radix + x[reversed ? count - 1 - i : i];
+	}
+	return value;
+}
+
+/* STR^count_radix of value, or its reverse */
+void strRadix(uint64_t value, unsigned int* x, int count, int radix, int reversed){
+	for(int i = 0; i < count; ++i){
+		x[reversed ? i : count - 1 - i] = (unsigned int) (value % radix);
+		value /= radix;
+	}
+}
+
+/* Check a token and split it into the halves. u is the length of A */
+int fpeStart(FPEToken* token, int radix, int u, uint64_t* a, uint64_t* b, int reversed){
+	token->ok = 0;
+	if(radix < 2 || radix > 65536 || token->n < 2){
+		return 0;
+	}
+	if(token->tweak_len < 0 || token->tweak_len > FPE_MAX_TWEAK){
+		return 0;
+	}
+	int v = token->n - u;
+	uint64_t domain = radixPower(radix, token->n);
+	if(radixPower(radix, u > v ? u : v) == 0 || (domain != 0 && domain < FPE_MIN_DOMAIN)){
+		return 0;
+	}
+	for(int i = 0; i < token->n; ++i){
+		if(token->in[i] >= (unsigned int) radix){
+			return 0;
+		}
+	}
+	*a = numRadix(token->in, u, radix, reversed);
+	*b = numRadix(token->in + u, v, radix, reversed);
+	return 1;
+}
+
+/* (x + y) mod modulus or (x - y) mod modulus, with x already below modulus */
+uint64_t feistelCombine(uint64_t x, unsigned __int128 y, uint64_t modulus, int decrypt){
+	uint64_t r = (uint64_t) (y % modulus);
+	if(decrypt){
+		return x >= r ? x - r : x + (modulus - r);
+	}
+	unsigned __int128 sum = (unsigned __int128) x + r;
+	return (uint64_t) (sum % modulus);
+}
+
+/* FF1 over up to LANES tokens */
+void ff1Lanes(FPEKey* fpe, int radix, FPEToken* tokens, int count, int decrypt){
+	uint64_t a[LANES], b[LANES];
+	int lane_token[LANES];
+	int lanes = 0;
+	for(int t = 0; t < count; ++t){
+		int u = tokens[t].n/2;
+		if(fpeStart(tokens + t, radix, u, a + lanes, b + lanes, 0)){
+			lane_token[lanes++] = t;
+		}
+	}
+	if(lanes == 0){
+		return;
+	}
+
+	unsigned char x[16*LANES];
+	unsigned char q[LANES][FPE_MAX_TWEAK + 32]; //Q of every lane, padded to whole blocks (t + b + 1 <= maxTlen + 9)
+	int q_blocks[LANES];
+	int bytes_b[LANES];
+	int d[LANES];
+	for(int l = 0; l < lanes; ++l){
+		FPEToken* token = tokens + lane_token[l];
+		int n = token->n, u = n/2, v = n - u, t = token->tweak_len;
+		//b = ceil(ceil(v*log2(radix))/8), where ceil(v*log2(radix)) is the bit length of radix^v - 1
+		uint64_t top = radixPower(radix, v) - 1;
+		int bits = 0;
+		while(bits < 64 && (top >> bits) != 0){
+			bits++;
+		}
+		bytes_b[l] = (bits + 7)/8;
+		d[l] = 4*((bytes_b[l] + 3)/4) + 4;
+		q_blocks[l] = (t + bytes_b[l] + 1 + 15)/16;
+		//P = [1][2][1][radix]^3[10][u mod 256][n]^4[t]^4
+		unsigned char* p = x + 16*l;
+		p[0] = 1;
+		p[1] = 2;
+		p[2] = 1;
+		p[3] = (unsigned char) (radix >> 16);
+		p[4] = (unsigned char) (radix >> 8);
+		p[5] = (unsigned char) radix;
+		p[6] = 10;
+		p[7] = (unsigned char) (u % 256);
+		for(int i = 0; i < 4; ++i){
+			p[8 + i] = (unsigned char) (n >> (8*(3 - i)));
+			p[12 + i] = (unsigned char) (t >> (8*(3 - i)));
+		}
+	}
+	//E(P) is the same in every round
+	unsigned char ep[16*LANES];
+	encryptBlocks(x, ep, lanes, fpe->expanded_key);
+
+	for(int round = 0; round < 10; ++round){
+		int i = decrypt ? 9 - round : round;
+		int max_blocks = 0;
+		for(int l = 0; l < lanes; ++l){
+			FPEToken* token = tokens + lane_token[l];
+			int t = token->tweak_len;
+			int len = 16*q_blocks[l];
+			//Q = T || zeros || [i] || [NUM_radix(B)]^b, with A in place of B when decrypting
+			uint64_t num = decrypt ? a[l] : b[l];
+			for(int k = 0; k < len; ++k){
+				q[l][k] = k < t ? token->tweak[k] : 0;
+			}
+			q[l][len - bytes_b[l] - 1] = (unsigned char) i;
+			for(int k = 0; k < bytes_b[l]; ++k){
+				q[l][len - 1 - k] = (unsigned char) (num >> (8*k));
+			}
+			for(int k = 0; k < 16; ++k){
+				x[16*l + k] = ep[16*l + k];
+			}
+			if(q_blocks[l] > max_blocks){
+				max_blocks = q_blocks[l];
+			}
+		}
+		//CBC-MAC over Q, lanes whose Q is already done keep their value
+		for(int j = 0; j < max_blocks; ++j){
+			unsigned char chain[16*LANES];
+			int active[LANES];
+			int na = 0;
+			for(int l = 0; l < lanes; ++l){
+				if(j < q_blocks[l]){
+					xorBytes(x + 16*l, q[l] + 16*j, chain + 16*na, 16);
+					active[na++] = l;
+				}
+			}
+			encryptBlocks(chain, chain, na, fpe->expanded_key);
+			for(int k = 0; k < na; ++k){
+				for(int c = 0; c < 16; ++c){
+					x[16*active[k] + c] = chain[16*k + c];
+				}
+			}
+		}
+		//y = NUM(first d bytes of R), d <= 12 here so S never needs more than R
+		for(int l = 0; l < lanes; ++l){
+			FPEToken* token = tokens + lane_token[l];
+			int u = token->n/2, v = token->n - u;
+			unsigned __int128 y = 0;
+			for(int k = 0; k < d[l]; ++k){
+				y = (y << 8) | x[16*l + k];
+			}
+			uint64_t modulus = radixPower(radix, i % 2 == 0 ? u : v);
+			if(decrypt){
+				uint64_t c = feistelCombine(b[l], y, modulus, 1);
+				b[l] = a[l];
+				a[l] = c;
+			}
+			else{
+				uint64_t c = feistelCombine(a[l], y, modulus, 0);
+				a[l] = b[l];
+				b[l] = c;
+			}
+		}
+	}
+	for(int l = 0; l < lanes; ++l){
+		FPEToken* token = tokens + lane_token[l];
+		int u = token->n/2;
+		strRadix(a[l], token->out, u, radix, 0);
+		strRadix(b[l], token->out + u, token->n - u, radix, 0);
+		token->ok = 1;
+	}
+}
+
+/* FF3-1 over up to LANES tokens */
+void ff3Lanes(FPEKey* fpe, int radix, FPEToken* tokens, int count, int decrypt){
+	uint64_t a[LANES], b[LANES];
+	int lane_token[LANES];
+	int lanes = 0;
+	for(int t = 0; t < count; ++t){
+		int u = (tokens[t].n + 1)/2;
+		//FF3-1 also needs radix^n <= 2^96, which the 64 bit halves already guarantee
+		if(tokens[t].tweak_len == 7 && fpeStart(tokens + t, radix, u, a + lanes, b + lanes, 1)){
+			lane_token[lanes++] = t;
+		}
+	}
+	unsigned char x[16*LANES];
+	for(int round = 0; round < 8; ++round){
+		int i = decrypt ? 7 - round : round;
+		for(int l = 0; l < lanes; ++l){
+			const unsigned char* tw = tokens[lane_token[l]].tweak;
+			//T_L = T[0..27] || 0000, T_R = T[32..55] || T[28..31] || 0000
+			unsigned char w[4];
+			if(i % 2 == 0){
+				w[0] = tw[4];
+				w[1] = tw[5];
+				w[2] = tw[6];
+				w[3] = (unsigned char) ((tw[3] & 0x0f) << 4);
+			}
+			else{
+				w[0] = tw[0];
+				w[1] = tw[1];
+				w[2] = tw[2];
+				w[3] = tw[3] & 0xf0;
+			}
+			w[3] ^= (unsigned char) i;
+			//P = W ^ [i]^4 || [NUM_radix(REV(B))]^12, fed to the cipher byte reversed
+			uint64_t num = decrypt ? a[l] : b[l];
+			unsigned char p[16] = {0};
+			for(int k = 0; k < 4; ++k){
+				p[k] = w[k];
+			}
+			for(int k = 0; k < 8; ++k){
+				p[15 - k] = (unsigned char) (num >> (8*k));
+			}
+			for(int k = 0; k < 16; ++k){
+				x[16*l + k] = p[15 - k];
+			}
+		}
+		encryptBlocks(x, x, lanes, fpe->reversed_key);
+		for(int l = 0; l < lanes; ++l){
+			FPEToken* token = tokens + lane_token[l];
+			int u = (token->n + 1)/2, v = token->n - u;
+			//S = REVB(output), y = NUM(S)
+			unsigned __int128 y = 0;
+			for(int k = 15; k >= 0; --k){
+				y = (y << 8) | x[16*l + k];
+			}
+			uint64_t modulus = radixPower(radix, i % 2 == 0 ? u : v);
+			if(decrypt){
+				uint64_t c = feistelCombine(b[l], y, modulus, 1);
+				b[l] = a[l];
+				a[l] = c;
+			}
+			else{
+				uint64_t c = feistelCombine(a[l], y, modulus, 0);
+				a[l] = b[l];
+				b[l] = c;
+			}
+		}
+	}
+	for(int l = 0; l < lanes; ++l){
+		FPEToken* token = tokens + lane_token[l];
+		int u = (token->n + 1)/2;
+		strRadix(a[l], token->out, u, radix, 1);
+		strRadix(b[l], token->out + u, token->n - u, radix, 1);
+		token->ok = 1;
+	}
+}
+
+/* Run count tokens through FF1 or FF3-1, LANES at a time. Each token's ok field tells whether it was valid */
+void fpeMany(FPEKey* fpe, int ff3, int radix, FPEToken* tokens, int count, int decrypt){
+	for(int t = 0; t < count; t += LANES){
+		int lanes = count - t < LANES ? count - t : LANES;
+		if(ff3){
+			ff3Lanes(fpe, radix, tokens + t, lanes, decrypt);
+		}
+		else{
+			ff1Lanes(fpe, radix, tokens + t, lanes, decrypt);
+		}
+	}
+}
+
+void ff1EncryptMany(FPEKey* fpe, int radix, FPEToken* tokens, int count){
+	fpeMany(fpe, 0, radix, tokens, count, 0);
+}
+
+void ff1DecryptMany(FPEKey* fpe, int radix, FPEToken* tokens, int count){
+	fpeMany(fpe, 0, radix, tokens, count, 1);
+}
+
+void ff3EncryptMany(FPEKey* fpe, int radix, FPEToken* tokens, int count){
+	fpeMany(fpe, 1, radix, tokens, count, 0);
+}
+
+void ff3DecryptMany(FPEKey* fpe, int radix, FPEToken* tokens, int count){
+	fpeMany(fpe, 1, radix, tokens, count, 1);
+}
+
+/* ---------- Seekable CTR and XTS ----------
+   Both modes derive the keystream / tweak of a block from its position alone, so a byte range can be decrypted
+   without touching anything before it. The range calls take the whole object (e.g. a mapping of it) and only
+   read the blocks that overlap [offset, offset + len); unaligned starts and ends are cut out of the first and
+   last block. CTR uses a 128 bit big endian counter (NIST SP 800-38A), XTS is XTS-AES-128 (IEEE 1619) with
+   data units that are a multiple of 16 bytes */
+
+/* block += n, as a 128 bit big endian number */
+void addCounter(unsigned char* block, uint64_t n){
+	for(int i = 15; i >= 0 && n != 0; --i){
+		uint64_t sum = block[i] + (n & 0xff);
+		block[i] = (unsigned char) sum;
+		n = (n >> 8) + (sum >> 8);
+	}
+}
+
+/* Encrypt or decrypt len bytes of an object in CTR mode, starting at byte offset. in points at the byte at
+   offset, out receives len bytes */
+void ctrCryptAt(unsigned char* expanded_key, const unsigned char* iv, long offset, const unsigned char* in, unsigned char* out, long len){
+	unsigned char counter[16];
+	unsigned char counters[16*LANES];
+	unsigned char keystream[16*LANES];
+	memcpy(counter, iv, 16);
+	addCounter(counter, (uint64_t) offset/16);
+	int skip = (int) (offset % 16); //keystream bytes of the first block before the range starts
+	while(len > 0){
+		long blocks = (skip + len + 15)/16;
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int l = 0; l < lanes; ++l){
+			memcpy(counters + 16*l, counter, 16);
+			addCounter(counter, 1);
+		}
+		encryptBlocks(counters, keystream, lanes, expanded_key);
+		long n = 16*lanes - skip < len ? 16*lanes - skip : len;
+		xorBytes(in, keystream + skip, out, (int) n);
+		in += n;
+		out += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+/* CTR over the range [offset, offset + len) of a whole object */
+void ctrCryptRange(unsigned char* expanded_key, const unsigned char* iv, const unsigned char* object, long offset, long len, unsigned char* out){
+	ctrCryptAt(expanded_key, iv, offset, object + offset, out, len);
+}
+
+struct XTSKey {
+	unsigned char data_key[176];   //key 1, encrypts the data
+	unsigned char tweak_key[176];  //key 2, encrypts the data unit number
+};
+
+/* key is 32 bytes: the data key followed by the tweak key */
+void xtsInit(XTSKey* xts, const unsigned char* key){
+	expandKey((unsigned char*) key, 16, xts->data_key, 176);
+	expandKey((unsigned char*) key + 16, 16, xts->tweak_key, 176);
+}
+
+/* Multiply the tweak by alpha in GF(2^128), XTS uses little endian byte order */
+void xtsDouble(unsigned char* t){
+	unsigned char carry = t[15] >> 7;
+	for(int i = 15; i > 0; --i){
+		t[i] = (unsigned char) ((t[i] << 1) | (t[i-1] >> 7));
+	}
+	t[0] = (unsigned char) ((t[0] << 1) ^ (0x87 & (0 - carry)));
+}
+
+/* Tweak of block number block inside data unit number unit: E_k2(unit) * alpha^block */
+void xtsTweak(XTSKey* xts, uint64_t unit, long block, unsigned char* t){
+	for(int i = 0; i < 16; ++i){
+		t[i] = i < 8 ? (unsigned char) (unit >> (8*i)) : 0;
+	}
+	encryptBlock(t, t, xts->tweak_key);
+	for(long i = 0; i < block; ++i){
+		xtsDouble(t);
+	}
+}
+
+/* Run blocks whole blocks of one data unit through XTS, starting with tweak t (which is advanced) */
+void xtsBlocks(XTSKey* xts, unsigned char* t, const unsigned char* in, unsigned char* out, long blocks, int decrypt){
+	unsigned char tweaks[16*LANES];
+	unsigned char x[16*LANES];
+	while(blocks > 0){
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int l = 0; l < lanes; ++l){
+			memcpy(tweaks + 16*l, t, 16);
+			xtsDouble(t);
+		}
+		xorBytes(in, tweaks, x, 16*lanes);
+		if(decrypt){
+			decryptBlocks(x, x, lanes, xts->data_key);
+		}
+		else{
+			encryptBlocks(x, x, lanes, xts->data_key);
+		}
+		xorBytes(x, tweaks, out, 16*lanes);
+		in += 16*lanes;
+		out += 16*lanes;
+		blocks -= lanes;
+	}
+}
+
+/* Encrypt or decrypt whole data units starting at data unit number first_unit. len must be a multiple of
+   unit_size, which must be a multiple of 16. Returns 0 if it is not */
+int xtsCryptUnits(XTSKey* xts, long unit_size, uint64_t first_unit, const unsigned char* in, unsigned char* out, long len, int decrypt){
+	if(unit_size <= 0 || unit_size % 16 != 0 || len % unit_size != 0){
+		return 0;
+	}
+	unsigned char t[16];
+	for(long off = 0; off < len; off += unit_size){
+		xtsTweak(xts, first_unit + off/unit_size, 0, t);
+		xtsBlocks(xts, t, in + off, out + off, unit_size/16, decrypt);
+	}
+	return 1;
+}
+
+/* Decrypt the range [offset, offset + len) of an XTS encrypted object whose data units are numbered from 0.
+   Returns 0 if unit_size is not a multiple of 16 */
+int xtsDecryptRange(XTSKey* xts, long unit_size, const unsigned char* object, long offset, long len, unsigned char* out){
+	if(unit_size <= 0 || unit_size % 16 != 0){
+		return 0;
+	}
+	unsigned char t[16];
+	unsigned char edge[16];
+	long end = offset + len;
+	long pos = offset;
+	while(pos < end){
+		long unit = pos/unit_size;
+		long unit_end = (unit + 1)*unit_size < end ? (unit + 1)*unit_size : end;
+		long first = (pos % unit_size)/16;             //first block touched in this unit
+		long last = ((unit_end - 1) % unit_size)/16;   //last block touched
+		xtsTweak(xts, (uint64_t) unit, first, t);
+		const unsigned char* base = object + unit*unit_size;
+		//a partial first block
+		if(pos % 16 != 0 || unit_end - pos < 16){
+			xtsBlocks(xts, t, base + 16*first, edge, 1, 1);
+			long n = 16 - pos % 16 < unit_end - pos ? 16 - pos % 16 : unit_end - pos;
+			memcpy(out, edge + pos % 16, n);
+			out += n;
+			pos += n;
+			first++;
+		}
+		//whole blocks straight to the output
+		long whole = (unit_end - pos)/16;
+		xtsBlocks(xts, t, base + 16*first, out, whole, 1);
+		out += 16*whole;
+		pos += 16*whole;
+		//a partial last block
+		if(pos < unit_end){
+			xtsBlocks(xts, t, base + 16*last, edge, 1, 1);
+			memcpy(out, edge, unit_end - pos);
+			out += unit_end - pos;
+			pos = unit_end;
+		}
+	}
+	return 1;
+}
+
+/* ---------- AES-SIV ----------
+   Theory from RFC 5297. The 32 byte key is split into a CMAC key for S2V and a CTR key. S2V chains the CMACs of
+   the associated data components with doublings, then CMACs the plaintext (with the chain value XORed into
+   its end). The synthetic IV V is the tag and, with two bits cleared, the initial CTR counter.
+   The batch calls push the CMACs of all components of all records through one cmacMany call and all the final
+   CMACs through a second one, so the serial CMAC chains of many short records run interleaved */
+struct SIVKey {
+	unsigned char mac_key[176];
+	unsigned char ctr_key[176];
+	CMACKey mac;
+	unsigned char zero_mac[16]; //CMAC(K, <zero>), the same for every record
+};
+
+/* One record: ad_count associated data components and the plaintext (seal) or ciphertext (open) */
+struct SIVRecord {
+	const unsigned char** ad;
+	const long* ad_lens;
+	int ad_count;
+	const unsigned char* in;
+	unsigned char* out;
+	long len;
+	unsigned char* v;  //16 byte synthetic IV, written by seal and checked by open
+	int ok;            //set by sivOpenMany
+};
+
+void sivInit(SIVKey* siv, const unsigned char* key){
+	unsigned char zero[16] = {0};
+	expandKey((unsigned char*) key, 16, siv->mac_key, 176);
+	expandKey((unsigned char*) key + 16, 16, siv->ctr_key, 176);
+	cmacInit(&siv->mac, siv->mac_key);
+	cmacMessage(&siv->mac, zero, 16, siv->zero_mac);
+}
+
+/* S2V over the associated data of every record and the given plaintexts, writing each record's V into vs */
+void sivS2VMany(SIVKey* siv, SIVRecord* records, int count, const unsigned char** plaintexts, unsigned char* vs){
+	if(count <= 0){
+		return;
+	}
+	long total_ad = 0;
+	for(int r = 0; r < count; ++r){
+		total_ad += records[r].ad_count;
+	}
+	//CMAC of every associated data component, all records at once
+	const unsigned char** msgs = new const unsigned char*[total_ad + count];
+	long* lens = new long[total_ad + count];
+	unsigned char* macs = new unsigned char[16*total_ad];
+	unsigned char** tags = new unsigned char*[total_ad + count];
+	const unsigned char** xorends = new const unsigned char*[count];
+	unsigned char* d = new unsigned char[16*count];
+	unsigned char* short_t = new unsigned char[16*count];
+	long k = 0;
+	for(int r = 0; r < count; ++r){
+		for(int i = 0; i < records[r].ad_count; ++i){
+			msgs[k] = records[r].ad[i];
+			lens[k] = records[r].ad_lens[i];
+			tags[k] = macs + 16*k;
+			k++;
+		}
+	}
+	cmacMany(&siv->mac, msgs, lens, (int) total_ad, tags);
+
+	//D = dbl(D) ^ CMAC(S_i), then T from the plaintext
+	k = 0;
+	for(int r = 0; r < count; ++r){
+		unsigned char* dr = d + 16*r;
+		memcpy(dr, siv->zero_mac, 16);
+		for(int i = 0; i < records[r].ad_count; ++i){
+			doubleBlock(dr, dr);
+			xorBytes(dr, macs + 16*k, dr, 16);
+			k++;
+		}
+		long len = records[r].len;
+		if(len >= 16){
+			msgs[r] = plaintexts[r];  //T = S_n xorend D, applied while the CMAC reads it
+			lens[r] = len;
+			xorends[r] = dr;
+		}
+		else{
+			unsigned char* t = short_t + 16*r; //T = dbl(D) ^ pad(S_n)
+			doubleBlock(dr, t);
+			xorBytes(t, plaintexts[r], t, (int) len);
+			t[len] ^= 0x80;
+			msgs[r] = t;
+			lens[r] = 16;
+			xorends[r] = NULL;
+		}
+		tags[r] = vs + 16*r;
+	}
+	cmacManyXorend(&siv->mac, msgs, lens, xorends, count, tags);
+
+	delete[] msgs;
+	delete[] lens;
+	delete[] macs;
+	delete[] tags;
+	delete[] xorends;
+	delete[] d;
+	delete[] short_t;
+}
+
+/* CTR pass keyed by V: Q = V with bit 63 and bit 31 (from the right) cleared */
+void sivCtr(SIVKey* siv, const unsigned char* v, const unsigned char* in, unsigned char* out, long len){
+	unsigned char q[16];
+	memcpy(q, v, 16);
+	q[8] &= 0x7f;
+	q[12] &= 0x7f;
+	ctrCryptAt(siv->ctr_key, q, 0, in, out, len);
+}
+
+/* Encrypt count records, writing each ciphertext to out and its synthetic IV to v */
+void sivSealMany(SIVKey* siv, SIVRecord* records, int count){
+	if(count <= 0){
+		return;
+	}
+	const unsigned char** plaintexts = new const unsigned char*[count];
+	unsigned char* vs = new unsigned char[16*count];
+	for(int r = 0; r < count; ++r){
+		plaintexts[r] = records[r].in;
+	}
+	sivS2VMany(siv, records, count, plaintexts, vs);
+	for(int r = 0; r < count; ++r){
+		memcpy(records[r].v, vs + 16*r, 16);
+		sivCtr(siv, records[r].v, records[r].in, records[r].out, records[r].len);
+		records[r].ok = 1;
+	}
+	delete[] plaintexts;
+	delete[] vs;
+}
+
+/* Decrypt and verify count records. Each record's ok field tells whether its V was valid, the output of a
+   failed record is zeroed. Returns 1 if all records were valid */
+int sivOpenMany(SIVKey* siv, SIVRecord* records, int count){
+	int all_ok = 1;
+	if(count <= 0){
+		return all_ok;
+	}
+	const unsigned char** plaintexts = new const unsigned char*[count];
+	unsigned char* vs = new unsigned char[16*count];
+	for(int r = 0; r < count; ++r){
+		sivCtr(siv, records[r].v, records[r].in, records[r].out, records[r].len);
+		plaintexts[r] = records[r].out;
+	}
+	sivS2VMany(siv, records, count, plaintexts, vs);
+	for(int r = 0; r < count; ++r){
+		records[r].ok = constantTimeEqual(vs + 16*r, records[r].v, 16);
+		if(!records[r].ok){
+			memset(records[r].out, 0, records[r].len);
+			all_ok = 0;
+		}
+	}
+	delete[] plaintexts;
+	delete[] vs;
+	return all_ok;
+}
+
+/* ---------- AES-GCM ----------
+   Theory from NIST SP 800-38D, with 12 byte IVs. GHASH runs on the POLYVAL code through the identity in RFC 8452
+   appendix A: GHASH(H, X) = REV(POLYVAL(mulX(REV(H)), REV(X_1), ..., REV(X_n))), where REV reverses the bytes
+   of a block. The CTR pass and GHASH are stitched per slice of GCM_SLICE blocks, so the ciphertext is
+   authenticated while it is still in cache */
+#define GCM_SLICE 64
+
+struct GCMKey {
+	unsigned char* expanded_key;
+	Polyval ghash; //set up with mulX(REV(H)), the accumulator is reset per message
+};
+
+/* Byte reverse a block, in and out may be the same */
+void reverseBlock(const unsigned char* in, unsigned char* out){
+	for(int i = 0; i < 8; ++i){
+		unsigned char t = in[i];
+		out[i] = in[15 - i];
+		out[15 - i] = t;
+	}
+}
+
+void gcmInit(GCMKey* gcm, unsigned char* expanded_key){
+	unsigned char h[16] = {0};
+	unsigned char rev[16];
+	uint64_t x[2];
+	gcm->expanded_key = expanded_key;
+	encryptBlock(h, h, expanded_key);
+	reverseBlock(h, rev);
+	loadBlock64(rev, x);
+	//mulX in the POLYVAL field: shift left by one and reduce by x^128 + x^127 + x^126 + x^121 + 1
+	uint64_t carry = x[1] >> 63;
+	x[1] = (x[1] << 1) | (x[0] >> 63);
+	x[0] <<= 1;
+	x[0] ^= carry;
+	x[1] ^= carry ? 0xc200000000000000ULL : 0;
+	storeBlock64(x, rev);
+	polyvalInit(&gcm->ghash, rev);
+}
+
+/* Absorb len bytes into GHASH, zero padding the last partial block */
+void ghashUpdate(Polyval* pv, const unsigned char* data, long len){
+	unsigned char rev[16*GCM_SLICE];
+	while(len > 0){
+		long n = len < 16*GCM_SLICE ? len : 16*GCM_SLICE;
+		long blocks = (n + 15)/16;
+		for(long b = 0; b < blocks; ++b){
+			unsigned char block[16] = {0};
+			memcpy(block, data + 16*b, n - 16*b < 16 ? n - 16*b : 16);
+			reverseBlock(block, rev + 16*b);
+		}
+		polyvalUpdate(pv, rev, blocks);
+		data += n;
+		len -= n;
+	}
+}
+
+/* CTR with the 32 bit big endian increment of GCM, counter is advanced past the blocks used */
+void gcmCtr(unsigned char* expanded_key, unsigned char* counter, const unsigned char* in, unsigned char* out, long len){
+	unsigned char counters[16*LANES];
+	unsigned char keystream[16*LANES];
+	uint32_t ctr = ((uint32_t) counter[12] << 24) | ((uint32_t) counter[13] << 16) | ((uint32_t) counter[14] << 8) | counter[15];
+	while(len > 0){
+		long blocks = (len + 15)/16;
+		int lanes = blocks < LANES ? (int) blocks : LANES;
+		for(int l = 0; l < lanes; ++l){
+			memcpy(counters + 16*l, counter, 12);
+			for(int b = 0; b < 4; ++b){
+				counters[16*l + 12 + b] = (unsigned char) (ctr >> (8*(3 - b)));
+			}
+			ctr++;
+		}
+		encryptBlocks(counters, keystream, lanes, expanded_key);
+		int n = len < 16*lanes ? (int) len : 16*lanes;
+		xorBytes(in, keystream, out, n);
+		in += n;
+		out += n;
+		len -= n;
+	}
+	for(int b = 0; b < 4; ++b){
+		counter[12 + b] = (unsigned char) (ctr >> (8*(3 - b)));
+	}
+}
+
+/* Both directions, GHASH always runs over the ciphertext. Returns 0 on a tag mismatch when decrypting
+   (the output is zeroed then) */
+int gcmCrypt(GCMKey* gcm, const unsigned char* iv, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag, int decrypt){
+	Polyval pv = gcm->ghash;
+	unsigned char j0[16];
+	unsigned char counter[16];
+	unsigned char s[16];
+	memcpy(j0, iv, 12);
+	j0[12] = j0[13] = j0[14] = 0;
+	j0[15] = 1;
+	memcpy(counter, j0, 16);
+	counter[15] = 2;
+	pv.acc[0] = pv.acc[1] = 0;
+	ghashUpdate(&pv, ad, ad_len);
+	for(long off = 0; off < len; off += 16*GCM_SLICE){
+		long n = len - off < 16*GCM_SLICE ? len - off : 16*GCM_SLICE;
+		if(decrypt){
+			ghashUpdate(&pv, in + off, n);
+		}
+		gcmCtr(gcm->expanded_key, counter, in + off, out + off, n);
+		if(!decrypt){
+			ghashUpdate(&pv, out + off, n);
+		}
+	}
+	//lengths block: len(A) || len(C) in bits, big endian
+	unsigned char lengths[16];
+	uint64_t bits[2] = {(uint64_t) ad_len*8, (uint64_t) len*8};
+	for(int b = 0; b < 8; ++b){
+		lengths[b] = (unsigned char) (bits[0] >> (8*(7 - b)));
+		lengths[8 + b] = (unsigned char) (bits[1] >> (8*(7 - b)));
+	}
+	ghashUpdate(&pv, lengths, 16);
+	storeBlock64(pv.acc, s);
+	reverseBlock(s, s);
+	encryptBlock(j0, j0, gcm->expanded_key);
+	xorBytes(s, j0, s, 16);
+	if(decrypt){
+		if(!constantTimeEqual(s, tag, 16)){
+			memset(out, 0, len);
+			return 0;
+		}
+		return 1;
+	}
+	memcpy(tag, s, 16);
+	return 1;
+}
+
+/* Encrypt len bytes with a 12 byte IV and write the 16 byte tag */
+void gcmSeal(GCMKey* gcm, const unsigned char* iv, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, unsigned char* tag){
+	gcmCrypt(gcm, iv, ad, ad_len, in, out, len, tag, 0);
+}
+
+/* Decrypt and verify. Returns 1 if the tag is valid, otherwise 0 and the output is zeroed */
+int gcmOpen(GCMKey* gcm, const unsigned char* iv, const unsigned char* ad, long ad_len,
+			const unsigned char* in, unsigned char* out, long len, const unsigned char* tag){
+	return gcmCrypt(gcm, iv, ad, ad_len, in, out, len, (unsigned char*) tag, 1);
+}
+
+/* ---------- Chunked AEAD container ----------
+   The STREAM construction (Hoang, Reyhanitabar, Rogaway, Vizar: "Online Authenticated-Encryption and its
+   Nonce-Reuse Misuse-Resistance"). The input is cut into chunks of chunk_size bytes and every chunk is sealed with
+   GCM under the nonce 0 (7 bytes) || chunk index || final flag, so chunks cannot be reordered, dropped or
+   truncated at a chunk boundary without detection. Layout:
+     header: "AESSTRM2" | chunk size (4 bytes, big endian) | salt (16 random bytes)
+     chunks: ciphertext | tag (16 bytes), every chunk but the last has exactly chunk_size bytes of ciphertext
+   The chunks are not sealed under the long term key but under a key of their own, derived from the salt with
+   the CMAC counter mode KDF of NIST SP 800-108, as Tink's streaming AEAD does. The nonces then only have to be
+   unique within one container, which they are by construction, and containers under one key only collide when
+   two 128 bit salts do. A random nonce prefix under the long term key would repeat after about 2^28 files.
+   The header is the associated data of every chunk. Groups of threads chunks are sealed or opened in parallel
+   by a pool of workers started once per container, memory stays at one group, and when opening a group is only
+   written out once all of its chunks verified.
+   The chunk index is 32 bits, so a container holds at most 2^32 chunks: past that the nonce would repeat */
+#define CONTAINER_MAGIC "AESSTRM2"
+#define CONTAINER_SALT 16
+#define CONTAINER_HEADER (12 + CONTAINER_SALT)
+#define CONTAINER_MAX_INDEX 0xFFFFFFFFL
+#define CONTAINER_MAX_CHUNK (1L << 30)    //1 GiB, also enforced on the header when opening
+
+struct ContainerChunk {
+	GCMKey* gcm;
+	const unsigned char* header;
+	unsigned char nonce[12];
+	const unsigned char* in;
+	unsigned char* out;
+	long len;        //plaintext length
+	int ok;
+};
+
+/* The chunk key: CMAC(K, [1]_32 || "AESSTRM2" || 0x00 || salt || [128]_32), one block of the SP 800-108 counter
+   mode KDF with the magic as label and the salt as context. Writes the expanded key */
+void containerKey(unsigned char* expanded_key, const unsigned char* header, unsigned char* chunk_key){
+	unsigned char input[4 + 8 + 1 + CONTAINER_SALT + 4] = {0, 0, 0, 1};
+	unsigned char key[16];
+	memcpy(input + 4, CONTAINER_MAGIC, 8);
+	memcpy(input + 13, header + 12, CONTAINER_SALT);
+	input[sizeof(input) - 1] = 128;
+	CMACKey cmac;
+	cmacInit(&cmac, expanded_key);
+	cmacMessage(&cmac, input, sizeof(input), key);
+	expandKey(key, 16, chunk_key, 176);
+}
+
+void containerNonce(long index, int final, unsigned char* nonce){
+	memset(nonce, 0, 7);
+	for(int b = 0; b < 4; ++b){
+		nonce[7 + b] = (unsigned char) (index >> (8*(3 - b)));
+	}
+	nonce[11] = (unsigned char) final;
+}
+
+/* The workers of one container. Every group bumps the generation, the workers take its chunks one at a time and
+   the last one to finish wakes the reader/writer thread */
+struct ContainerPool {
+	std::mutex lock;
+	std::condition_variable work;    //a new group, or stop
+	std::condition_variable done;    //every chunk of the group finished
+	std::vector<std::thread> workers;
+	ContainerChunk* chunks;
+	int count;
+	int open;
+	int next;                        //next chunk to hand out
+	int pending;                     //chunks of the group not finished yet
+	long generation;
+	int stop;
+};
+
+/* Seal (out gets ciphertext || tag) or open (in is ciphertext || tag) one chunk */
+void containerChunk(ContainerChunk* chunk, int open){
+	if(open){
+		chunk->ok = gcmOpen(chunk->gcm, chunk->nonce, chunk->header, CONTAINER_HEADER, chunk->in, chunk->out, chunk->len, chunk->in + chunk->len);
+	}
+	else{
+		gcmSeal(chunk->gcm, chunk->nonce, chunk->header, CONTAINER_HEADER, chunk->in, chunk->out, chunk->len, chunk->out + chunk->len);
+		chunk->ok = 1;
+	}
+}
+
+void containerWorker(ContainerPool* pool){
+	long seen = 0;
+	std::unique_lock<std::mutex> lock(pool->lock);
+	for(;;){
+		while(!pool->stop && pool->generation == seen){
+			pool->work.wait(lock);
+		}
+		if(pool->stop){
+			return;
+		}
+		seen = pool->generation;
+		while(pool->next < pool->count){
+			ContainerChunk* chunk = pool->chunks + pool->next++;
+			lock.unlock();
+			containerChunk(chunk, pool->open);
+			lock.lock();
+			if(--pool->pending == 0){
+				pool->done.notify_one();
+			}
+		}
+	}
+}
+
+void containerPoolStart(ContainerPool* pool, int threads){
+	pool->count = pool->next = pool->pending = 0;
+	pool->generation = 0;
+	pool->stop = 0;
+	for(int t = 0; t < threads; ++t){
+		pool->workers.push_back(std::thread(containerWorker, pool));
+	}
+}
+
+void containerPoolStop(ContainerPool* pool){
+	{
+		std::lock_guard<std::mutex> lock(pool->lock);
+		pool->stop = 1;
+	}
+	pool->work.notify_all();
+	for(size_t w = 0; w < pool->workers.size(); ++w){
+		pool->workers[w].join();
+	}
+}
+
+/* Run every chunk of a group through the pool and wait for all of them */
+void containerGroup(ContainerPool* pool, ContainerChunk* chunks, int count, int open){
+	std::unique_lock<std::mutex> lock(pool->lock);
+	pool->chunks = chunks;
+	pool->count = count;
+	pool->open = open;
+	pool->next = 0;
+	pool->pending = count;
+	pool->generation++;
+	pool->work.notify_all();
+	while(pool->pending > 0){
+		pool->done.wait(lock);
+	}
+}
+
+/* Read up to len bytes. Returns the number read and sets *at_end if nothing follows them, -1 on a read error */
+long containerRead(FILE* in, unsigned char* buf, long len, int* at_end){
+	long got = (long) fread(buf, 1, len, in);
+	*at_end = 1;
+	if(ferror(in)){
+		return -1;
+	}
+	if(got == len){
+		int c = getc(in); //peek, the last chunk is only known once the input ends
+		if(c != EOF){
+			ungetc(c, in);
+			*at_end = 0;
+		}
+	}
+	return got;
+}
+
+/* Seal everything from in into a container on out. Returns 0 on success, 1 if the input needs more chunks
+   than the index can number, 2 on a read or write error (out is flushed but not closed) */
+int containerSeal(unsigned char* expanded_key, FILE* in, FILE* out, long chunk_size, int threads){
+	GCMKey gcm;
+	unsigned char header[CONTAINER_HEADER];
+	unsigned char chunk_key[176];
+	memcpy(header, CONTAINER_MAGIC, 8);
+	for(int b = 0; b < 4; ++b){
+		header[8 + b] = (unsigned char) (chunk_size >> (8*(3 - b)));
+	}
+	if(!drbgThreadBytes(header + 12, CONTAINER_SALT) || fwrite(header, 1, CONTAINER_HEADER, out) != CONTAINER_HEADER){
+		return 2;
+	}
+	containerKey(expanded_key, header, chunk_key);
+	gcmInit(&gcm, chunk_key);
+
+	unsigned char* plain = new unsigned char[chunk_size*threads];
+	unsigned char* sealed = new unsigned char[(chunk_size + 16)*threads];
+	ContainerChunk* chunks = new ContainerChunk[threads];
+	ContainerPool pool;
+	containerPoolStart(&pool, threads);
+	long index = 0;
+	int at_end = 0;
+	int result = 0;
+	while(!at_end){
+		long got = containerRead(in, plain, chunk_size*threads, &at_end);
+		if(got < 0){
+			result = 2;
+			break;
+		}
+		int count = got == 0 ? 1 : (int) ((got + chunk_size - 1)/chunk_size); //empty input still gets a final chunk
+		if(index + count - 1 > CONTAINER_MAX_INDEX){
+			result = 1; //never seal two chunks under the same nonce
+			break;
+		}
+		for(int c = 0; c < count; ++c){
+			ContainerChunk* chunk = chunks + c;
+			chunk->gcm = &gcm;
+			chunk->header = header;
+			chunk->in = plain + chunk_size*c;
+			chunk->out = sealed + (chunk_size + 16)*c;
+			chunk->len = got - chunk_size*c < chunk_size ? got - chunk_size*c : chunk_size;
+			containerNonce(index++, at_end && c == count - 1, chunk->nonce);
+		}
+		containerGroup(&pool, chunks, count, 0);
+		for(int c = 0; c < count && result == 0; ++c){
+			if(fwrite(chunks[c].out, 1, chunks[c].len + 16, out) != (size_t) (chunks[c].len + 16)){
+				result = 2;
+			}
+		}
+		if(result != 0){
+			break;
+		}
+	}
+	if(fflush(out) != 0 && result == 0){
+		result = 2;
+	}
+	delete[] plain;
+	delete[] sealed;
+	containerPoolStop(&pool);
+	delete[] chunks;
+	return result;
+}
+
+/* Open a container from in, writing the plaintext to out. Returns 0 on success, 1 if the container is
+   malformed, truncated or fails to verify, 2 on a read or write error. Nothing from a failed group is written */
+int containerOpen(unsigned char* expanded_key, FILE* in, FILE* out, int threads){
+	GCMKey gcm;
+	unsigned char header[CONTAINER_HEADER];
+	unsigned char chunk_key[176];
+	if(fread(header, 1, CONTAINER_HEADER, in) != CONTAINER_HEADER || memcmp(header, CONTAINER_MAGIC, 8) != 0){
+		return 1;
+	}
+	containerKey(expanded_key, header, chunk_key);
+	gcmInit(&gcm, chunk_key);
+	long chunk_size = ((long) header[8] << 24) | ((long) header[9] << 16) | ((long) header[10] << 8) | header[11];
+	if(chunk_size < 1 || chunk_size > CONTAINER_MAX_CHUNK){
+		return 1; //the header is not authenticated yet, so do not let it size the buffers
+	}
+	unsigned char* sealed = new unsigned char[(chunk_size + 16)*threads];
+	unsigned char* plain = new unsigned char[chunk_size*threads];
+	ContainerChunk* chunks = new ContainerChunk[threads];
+	ContainerPool pool;
+	containerPoolStart(&pool, threads);
+	long index = 0;
+	int at_end = 0;
+	int result = 0;
+	while(!at_end && result == 0){
+		long got = containerRead(in, sealed, (chunk_size + 16)*threads, &at_end);
+		if(got < 0){
+			result = 2;
+			break;
+		}
+		int count = (int) ((got + chunk_size + 15)/(chunk_size + 16));
+		if(count == 0 || got - (chunk_size + 16)*(count - 1) < 16){
+			result = 1; //a chunk too short to hold its tag, or the final chunk is missing
+			break;
+		}
+		if(index + count - 1 > CONTAINER_MAX_INDEX){
+			result = 1; //no sealer numbers this many chunks
+			break;
+		}
+		for(int c = 0; c < count; ++c){
+			ContainerChunk* chunk = chunks + c;
+			long stored = got - (chunk_size + 16)*c < chunk_size + 16 ? got - (chunk_size + 16)*c : chunk_size + 16;
+			chunk->gcm = &gcm;
+			chunk->header = header;
+			chunk->in = sealed + (chunk_size + 16)*c;
+			chunk->out = plain + chunk_size*c;
+			chunk->len = stored - 16;
+			containerNonce(index++, at_end && c == count - 1, chunk->nonce);
+		}
+		containerGroup(&pool, chunks, count, 1);
+		for(int c = 0; c < count; ++c){
+			if(!chunks[c].ok){
+				result = 1;
+			}
+		}
+		for(int c = 0; c < count && result == 0; ++c){
+			if(fwrite(chunks[c].out, 1, chunks[c].len, out) != (size_t) chunks[c].len){
+				result = 2;
+			}
+		}
+	}
+	if(fflush(out) != 0 && result == 0){
+		result = 2;
+	}
+	delete[] sealed;
+	delete[] plain;
+	containerPoolStop(&pool);
+	delete[] chunks;
+	return result;
+}
+
+/* ---------- Duplicate block memo for ECB ----------
+   In ECB equal plaintext blocks give equal ciphertext, and sparse images, zero filled regions and fixed record
+   headers repeat a lot. The memo sits in front of the block cipher: an all zero block is answered from E(0)
+   (or D(0)) right away, any other block is looked up in a direct mapped table of MEMO_SIZE entries (32 KiB, so
+   it stays in L1/L2) and only misses go to the cipher, still in batches so the lanes stay full. The hit rate is
+   checked every MEMO_WINDOW blocks, and when fewer than 1 in MEMO_MIN_RATE hit, the memo steps aside for
+   MEMO_BACKOFF blocks before trying again. This pays off on the reference engine; AES-NI is faster than a lookup */
+#define MEMO_BITS 10
+#define MEMO_SIZE (1 << MEMO_BITS)
+#define MEMO_BATCH 64
+#define MEMO_WINDOW 4096
+#define MEMO_MIN_RATE 8
+#define MEMO_BACKOFF (1L << 18)
+
+struct MemoEntry {
+	uint64_t lo;             //the block, all zero means empty: the zero block never goes in the table
+	uint64_t hi;
+	unsigned char value[16];
+};
+
+struct BlockMemo {
+	unsigned char* expanded_key;
+	int decrypt;
+	unsigned char zero_value[16];
+	MemoEntry table[MEMO_SIZE];
+	long lookups;            //in the current window
+	long hits;
+	long skip;               //blocks left to pass straight through
+};
+
+void memoInit(BlockMemo* m, unsigned char* expanded_key, int decrypt){
+	unsigned char zero[16] = {0};
+	m->expanded_key = expanded_key;
+	m->decrypt = decrypt;
+	if(decrypt){
+		decryptBlock(zero, m->zero_value, expanded_key);
+	}
+	else{
+		encryptBlock(zero, m->zero_value, expanded_key);
+	}
+	memset(m->table, 0, sizeof(m->table));
+	m->lookups = 0;
+	m->hits = 0;
+	m->skip = 0;
+}
+
+void memoCipher(BlockMemo* m, const unsigned char* in, unsigned char* out, long n){
+	if(m->decrypt){
+		decryptBlocks(in, out, (int) n, m->expanded_key);
+	}
+	else{
+		encryptBlocks(in, out, (int) n, m->expanded_key);
+	}
+}
+
+MemoEntry* memoSlot(BlockMemo* m, uint64_t lo, uint64_t hi){
+	return m->table + ((lo*0x9e3779b97f4a7c15ULL ^ hi*0xc2b2ae3d27d4eb4fULL) >> (64 - MEMO_BITS));
+}
+
+/* Run the batched misses through the cipher, scatter them and remember them */
+void memoFlush(BlockMemo* m, const unsigned char* miss_in, const long* miss_at, int misses, unsigned char* out){
+	unsigned char miss_out[16*MEMO_BATCH];
+	if(misses == 0){
+		return;
+	}
+	memoCipher(m, miss_in, miss_out, misses);
+	for(int i = 0; i < misses; ++i){
+		MemoEntry* e;
+		uint64_t lo, hi;
+		memcpy(&lo, miss_in + 16*i, 8);
+		memcpy(&hi, miss_in + 16*i + 8, 8);
+		e = memoSlot(m, lo, hi);
+		e->lo = lo;
+		e->hi = hi;
+		memcpy(e->value, miss_out + 16*i, 16);
+		memcpy(out + 16*miss_at[i], miss_out + 16*i, 16);
+	}
+}
+
+/* ECB over whole blocks through the memo. in and out must not overlap */
+void memoBlocks(BlockMemo* m, const unsigned char* in, unsigned char* out, long blocks){
+	if(m->skip > 0){
+		long n = blocks < m->skip ? blocks : m->skip;
+		memoCipher(m, in, out, n);
+		m->skip -= n;
+		in += 16*n;
+		out += 16*n;
+		blocks -= n;
+	}
+	unsigned char miss_in[16*MEMO_BATCH];
+	long miss_at[MEMO_BATCH];
+	int misses = 0;
+	for(long b = 0; b < blocks; ++b){
+		uint64_t lo, hi;
+		memcpy(&lo, in + 16*b, 8);
+		memcpy(&hi, in + 16*b + 8, 8);
+		if((lo | hi) == 0){
+			memcpy(out + 16*b, m->zero_value, 16);
+			m->hits++;
+		}
+		else{
+			MemoEntry* e = memoSlot(m, lo, hi);
+			if(e->lo == lo && e->hi == hi){
+				memcpy(out + 16*b, e->value, 16);
+				m->hits++;
+			}
+			else{
+				memcpy(miss_in + 16*misses, in + 16*b, 16);
+				miss_at[misses++] = b;
+				if(misses == MEMO_BATCH){
+					memoFlush(m, miss_in, miss_at, misses, out);
+					misses = 0;
+				}
+			}
+		}
+		if(++m->lookups == MEMO_WINDOW){
+			int low = m->hits*MEMO_MIN_RATE < m->lookups;
+			m->lookups = 0;
+			m->hits = 0;
+			if(low){
+				memoFlush(m, miss_in, miss_at, misses, out);
+				m->skip = MEMO_BACKOFF;
+				memoBlocks(m, in + 16*(b + 1), out + 16*(b + 1), blocks - b - 1);
+				return;
+			}
+		}
+	}
+	memoFlush(m, miss_in, miss_at, misses, out);
+}
+
+/* ---------- Streaming ECB/CBC with PKCS#7 ----------
+   Theory from https://en.wikipedia.org/wiki/Block_cipher_mode_of_operation and RFC 5652 section 6.3 (padding).
+   Whole blocks go straight from the caller's input to its output. Only a trailing partial block is kept in
+   the stream, and when decrypting with padding also the last full block, since it may turn out to be the
+   padding block. streamFinal pads (encrypt) or checks and strips the padding (decrypt).
+   With ciphertext stealing the last full block and the partial one are kept instead, and streamFinal
+   finishes them in place so the output has exactly the length of the input */
+#define STREAM_ECB 0
+#define STREAM_CBC 1
+
+struct BlockStream {
+	unsigned char* expanded_key;
+	int mode;
+	int decrypt;
+	int pad;
+	int cts;                //ciphertext stealing instead of padding: 0 off, 1-3 for CBC-CS1/2/3 (any for ECB-CTS)
+	unsigned char iv[16];   //CBC chaining value
+	unsigned char held[32];
+	int held_len;
+	BlockMemo* memo;        //ECB only, NULL when off. Not shared between threads
+};
+
+void streamInit(BlockStream* s, unsigned char* expanded_key, int mode, int decrypt, int pad, int cts, const unsigned char* iv){
+	s->expanded_key = expanded_key;
+	s->mode = mode;
+	s->decrypt = decrypt;
+	s->pad = pad;
+	s->cts = cts;
+	for(int b = 0; b < 16; ++b){
+		s->iv[b] = iv != NULL ? iv[b] : 0;
+	}
+	s->held_len = 0;
+	s->memo = NULL;
+}
+
+/* Run whole blocks through the mode. in and out must not overlap */
+void streamBlocks(BlockStream* s, const unsigned char* in, unsigned char* out, long blocks){
+	while(blocks > 0){
+		int n = blocks < (1 << 20) ? (int) blocks : (1 << 20);
+		if(s->mode == STREAM_ECB && s->memo != NULL){
+			memoBlocks(s->memo, in, out, n);
+		}
+		else if(s->mode == STREAM_ECB){
+			if(s->decrypt){
+				decryptBlocks(in, out, n, s->expanded_key);
+			}
+			else{
+				encryptBlocks(in, out, n, s->expanded_key);
+			}
+		}
+		else if(s->decrypt){
+			//every plaintext block only needs its own and the previous ciphertext block, so the whole run is decrypted at once
+			decryptBlocks(in, out, n, s->expanded_key);
+			xorBytes(out, s->iv, out, 16);
+			xorBytes(out + 16, in, out + 16, 16*(n - 1));
+			memcpy(s->iv, in + 16*(n - 1), 16);
+		}
+		else{
+			for(int i = 0; i < n; ++i){
+				xorBytes(in + 16*i, s->iv, out + 16*i, 16);
+				encryptBlock(out + 16*i, out + 16*i, s->expanded_key);
+				memcpy(s->iv, out + 16*i, 16);
+			}
+		}
+		in += 16*n;
+		out += 16*n;
+		blocks -= n;
+	}
+}
+
+/* How many of the total buffered + incoming bytes have to stay in the stream after an update */
+long streamKeep(BlockStream* s, long total){
+	if(s->cts){
+		//the last full block and the partial one after it are needed by streamFinal (17 to 32 bytes)
+		return total >= 33 ? total - 16*((total - 17)/16) : total;
+	}
+	if(s->decrypt && s->pad && total % 16 == 0){
+		return total > 0 ? 16 : 0; //might be the padding block
+	}
+	return total % 16;
+}
+
+/* Process len bytes, out needs room for len + 16 bytes. Returns the number of bytes written */
+long streamUpdate(BlockStream* s, const unsigned char* in, long len, unsigned char* out){
+	long emit = s->held_len + len - streamKeep(s, s->held_len + len);
+	long written = 0;
+	//whole blocks that are already held
+	while(emit >= 16 && s->held_len >= 16){
+		streamBlocks(s, s->held, out + written, 1);
+		memmove(s->held, s->held + 16, s->held_len - 16);
+		s->held_len -= 16;
+		written += 16;
+		emit -= 16;
+	}
+	//a held partial block, completed from the input
+	if(emit >= 16 && s->held_len > 0){
+		int take = 16 - s->held_len;
+		memcpy(s->held + s->held_len, in, take);
+		in += take;
+		len -= take;
+		streamBlocks(s, s->held, out + written, 1);
+		s->held_len = 0;
+		written += 16;
+		emit -= 16;
+	}
+	//the rest straight from the input
+	if(emit > 0){
+		streamBlocks(s, in, out + written, emit/16);
+		in += emit;
+		len -= emit;
+		written += emit;
+	}
+	memcpy(s->held + s->held_len, in, len);
+	s->held_len += (int) len;
+	return written;
+}
+
+/* Ciphertext stealing on the last full block P(n-1) and the d byte block Pn* after it, theory from the
+   addendum to NIST SP 800-38A. In canonical (CS1) order the output is C(n-1)* || Cn, where C(n-1)* is the first
+   d bytes of C(n-1) and Cn = E(C(n-1) ^ (Pn* || 0)). CS2 swaps the two when d < 16 and CS3 always swaps.
+   ECB-CTS fills the tail of Pn* with the stolen tail of E(P(n-1)) and swaps like CS2 */
+long streamFinalStealing(BlockStream* s, unsigned char* out){
+	int d = s->held_len - 16;
+	unsigned char* held = s->held;
+	unsigned char x[16];
+	unsigned char y[16];
+	int swapped = s->cts == 3 || (s->cts == 2 && d < 16);
+	if(s->mode == STREAM_ECB){
+		swapped = d < 16;
+		if(!swapped){
+			streamBlocks(s, held, out, 2);
+			return 32;
+		}
+		if(!s->decrypt){
+			encryptBlock(held, x, s->expanded_key);            //E(P(n-1)), its tail is stolen
+			memcpy(y, held + 16, d);
+			memcpy(y + d, x + d, 16 - d);
+			encryptBlock(y, out, s->expanded_key);             //Cn
+			memcpy(out + 16, x, d);                            //C(n-1)*
+		}
+		else{
+			decryptBlock(held, y, s->expanded_key);            //Pn* || stolen tail
+			memcpy(x, held + 16, d);
+			memcpy(x + d, y + d, 16 - d);
+			decryptBlock(x, out, s->expanded_key);             //P(n-1)
+			memcpy(out + 16, y, d);
+		}
+		return 16 + d;
+	}
+
+	if(!s->decrypt){
+		xorBytes(held, s->iv, x, 16);
+		encryptBlock(x, x, s->expanded_key);                   //C(n-1)
+		memcpy(y, x, 16);
+		xorBytes(y, held + 16, y, d);                          //C(n-1) ^ (Pn* || 0)
+		encryptBlock(y, y, s->expanded_key);                   //Cn
+		if(swapped){
+			memcpy(out, y, 16);
+			memcpy(out + 16, x, d);
+		}
+		else{
+			memcpy(out, x, d);
+			memcpy(out + d, y, 16);
+		}
+		memcpy(s->iv, y, 16);
+		return 16 + d;
+	}
+
+	//bring the two pieces into canonical order: c_star (d bytes) and cn
+	unsigned char c_star[16];
+	unsigned char cn[16];
+	memcpy(c_star, swapped ? held + 16 : held, d);
+	memcpy(cn, swapped ? held : held + d, 16);
+	decryptBlock(cn, y, s->expanded_key);                      //Z = C(n-1) ^ (Pn* || 0)
+	memcpy(x, c_star, d);
+	memcpy(x + d, y + d, 16 - d);                              //C(n-1) = C(n-1)* || tail of Z
+	xorBytes(y, c_star, out + 16, d);                          //Pn*
+	decryptBlock(x, out, s->expanded_key);
+	xorBytes(out, s->iv, out, 16);                             //P(n-1)
+	memcpy(s->iv, cn, 16);
+	return 16 + d;
+}
+
+/* Finish the stream, out needs room for 32 bytes. Returns the number of bytes written, or -1 if the input
+   was not a whole number of blocks (without padding), too short for ciphertext stealing or the padding was invalid */
+long streamFinal(BlockStream* s, unsigned char* out){
+	if(s->cts){
+		long n = s->held_len;
+		if(n == 0 || n == 16){
+			streamBlocks(s, s->held, out, n/16);
+			s->held_len = 0;
+			return n;
+		}
+		if(n < 16){
+			return -1;
+		}
+		n = streamFinalStealing(s, out);
+		s->held_len = 0;
+		return n;
+	}
+	if(!s->pad){
+		return s->held_len == 0 ? 0 : -1;
+	}
+	if(!s->decrypt){
+		unsigned char p = (unsigned char) (16 - s->held_len);
+		for(int b = s->held_len; b < 16; ++b){
+			s->held[b] = p;
+		}
+		streamBlocks(s, s->held, out, 1);
+		s->held_len = 0;
+		return 16;
+	}
+	if(s->held_len != 16){
+		return -1;
+	}
+	unsigned char last[16];
+	streamBlocks(s, s->held, last, 1);
+	s->held_len = 0;
+	//check the padding without branching on its bytes: 1 <= p <= 16 and the last p bytes all equal p
+	unsigned char p = last[15];
+	unsigned char bad = (unsigned char) ((p == 0) | (p > 16));
+	for(int b = 0; b < 16; ++b){
+		unsigned char in_pad = (unsigned char) (0 - (unsigned char) (b >= 16 - p)); //0xff for padding bytes
+		bad |= in_pad & (last[b] ^ p);
+	}
+	if(bad != 0){
+		return -1;
+	}
+	memcpy(out, last, 16 - p);
+	return 16 - p;
+}
+
+/* ---------- Bulk I/O ----------
+   Raw read(2)/write(2) on page aligned buffers of IO_BUFFER bytes. readFull keeps reading until the buffer is full
+   or the input ends, so short reads from pipes and terminals never reach the cipher as odd sized pieces, and every
+   buffer but the last hands whole blocks to the bulk kernel */
+#define IO_BUFFER (4L << 20)
+#define IO_ALIGN 4096
+
+unsigned char* allocAligned(long len){
+	void* p = NULL;
+	if(posix_memalign(&p, IO_ALIGN, len) != 0){
+		return NULL;
+	}
+	return (unsigned char*) p;
+}
+
+/* Read up to len bytes. Returns the number read, which is less than len only at end of input, or -1 on error */
+long readFull(int fd, unsigned char* buf, long len){
+	long got = 0;
+	while(got < len){
+		ssize_t r = read(fd, buf + got, len - got);
+		if(r < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		if(r == 0){
+			break;
+		}
+		got += r;
+	}
+	return got;
+}
+
+/* Write all len bytes. Returns 0, or -1 on error */
+int writeFull(int fd, const unsigned char* buf, long len){
+	while(len > 0){
+		ssize_t w = write(fd, buf, len);
+		if(w < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+/* Result of the stream drivers below */
+#define RUN_OK 0
+#define RUN_STREAM_ERROR -1 //streamFinal rejected the input
+#define RUN_IO_ERROR -2
+#define RUN_BAD_JOURNAL -3
+#define RUN_BAD_TEXT -4       //--hex or --base64 input that does not decode
+#define RUN_SAME_FILE -5      //a batch output that is its own input
+
+/* Run everything from in_fd through the stream into out_fd with the bulk buffers */
+int runStream(BlockStream* s, int in_fd, int out_fd){
+	unsigned char *in_buf = allocAligned(IO_BUFFER);
+	unsigned char *out_buf = allocAligned(IO_BUFFER + IO_ALIGN); //streamUpdate may emit up to 16 bytes more than it got
+	int result = RUN_OK;
+	long got;
+	do{
+		got = readFull(in_fd, in_buf, IO_BUFFER);
+		if(got < 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		long written = streamUpdate(s, in_buf, got, out_buf);
+		if(writeFull(out_fd, out_buf, written) != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+	} while(got == IO_BUFFER);
+	if(result == RUN_OK){
+		long written = streamFinal(s, out_buf);
+		if(written < 0){
+			result = RUN_STREAM_ERROR;
+		}
+		else if(writeFull(out_fd, out_buf, written) != 0){
+			result = RUN_IO_ERROR;
+		}
+	}
+	free(in_buf);
+	free(out_buf);
+	return result;
+}
+
+/* ---------- Hex and base64 ----------
+   --hex and --base64 take the key, IV and data as text and write the result as text, so text based callers need
+   no converter around the binary. Decoding skips whitespace, so wrapped input is fine, and output ends with a
+   newline. The vector kernels handle runs of clean text: hex with SSSE3 (16 bytes a step) or AVX2 (32),
+   base64 with SSSE3 (12 bytes a step) after the decoder by Mula and Lemire, "Faster Base64 Encoding and Decoding
+   using AVX2 Instructions". A run that holds whitespace, padding or a bad character falls to the scalar code,
+   which is also what cpus without SSSE3 use. runText converts slice by slice, so the text, the cipher input and
+   its output are all still in cache when the next step gets them */
+#define CODEC_RAW 0
+#define CODEC_HEX 1
+#define CODEC_BASE64 2
+#define TEXT_SLICE (48L << 10)
+
+struct TextCodec {
+	int kind;
+	unsigned char pending[4];    //decode: values of a partial group, encode: bytes short of a base64 group
+	int pending_len;
+	int ended;                   //base64 padding seen, only whitespace and the rest of the padding may follow
+	int pad_needed;
+	int error;
+};
+
+void codecInit(TextCodec* c, int kind){
+	c->kind = kind;
+	c->pending_len = 0;
+	c->ended = 0;
+	c->pad_needed = 0;
+	c->error = 0;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Value of a text character, -1 if it is not a digit of the codec */
+int codecValue(int kind, unsigned char ch){
+	if(kind == CODEC_HEX){
+		if(ch >= '0' && ch <= '9') return ch - '0';
+		if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+		if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+		return -1;
+	}
+	if(ch >= 'A' && ch <= 'Z') return ch - 'A';
+	if(ch >= 'a' && ch <= 'z') return ch - 'a' + 26;
+	if(ch >= '0' && ch <= '9') return ch - '0' + 52;
+	if(ch == '+') return 62;
+	if(ch == '/') return 63;
+	return -1;
+}
+
+/* codecValue for every character of each codec, so the scalar decoder is a table lookup */
+signed char codec_values[3][256];
+
+int initCodecValues(){
+	for(int kind = CODEC_HEX; kind <= CODEC_BASE64; ++kind){
+		for(int ch = 0; ch < 256; ++ch){
+			codec_values[kind][ch] = (signed char) codecValue(kind, (unsigned char) ch);
+		}
+	}
+	return 1;
+}
+int codec_values_ready = initCodecValues();
+
+#ifdef HAVE_AESNI_PATH
+/* The vector kernels return how much text (decode) or how many bytes (encode) they took, always whole steps */
+__attribute__((target("ssse3")))
+long hexDecodeSsse3(const unsigned char* in, long len, unsigned char* out){
+	const __m128i zero_char = _mm_set1_epi8('0');
+	const __m128i a_char = _mm_set1_epi8('a');
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i five = _mm_set1_epi8(5);
+	const __m128i ten = _mm_set1_epi8(10);
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i weights = _mm_set1_epi16(0x0110); //16*first + second
+	long done = 0;
+	for(; done + 32 <= len; done += 32){
+		__m128i v[2];
+		int valid = 1;
+		for(int h = 0; h < 2; ++h){
+			__m128i c = _mm_loadu_si128((const __m128i*) (in + done + 16*h));
+			__m128i d = _mm_sub_epi8(c, zero_char);
+			__m128i l = _mm_sub_epi8(_mm_or_si128(c, lower), a_char);
+			__m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+			__m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(l, five), l);
+			valid &= _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) == 0xffff;
+			v[h] = _mm_or_si128(_mm_and_si128(is_digit, d), _mm_andnot_si128(is_digit, _mm_add_epi8(l, ten)));
+			v[h] = _mm_maddubs_epi16(v[h], weights);
+		}
+		if(!valid){
+			break;
+		}
+		_mm_storeu_si128((__m128i*) (out + done/2), _mm_packus_epi16(v[0], v[1]));
+	}
+	return done;
+}
+
+__attribute__((target("avx2")))
+long hexDecodeAvx2(const unsigned char* in, long len, unsigned char* out){
+	const __m256i zero_char = _mm256_set1_epi8('0');
+	const __m256i a_char = _mm256_set1_epi8('a');
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i five = _mm256_set1_epi8(5);
+	const __m256i ten = _mm256_set1_epi8(10);
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i weights = _mm256_set1_epi16(0x0110);
+	long done = 0;
+	for(; done + 64 <= len; done += 64){
+		__m256i v[2];
+		int valid = 1;
+		for(int h = 0; h < 2; ++h){
+			__m256i c = _mm256_loadu_si256((const __m256i*) (in + done + 32*h));
+			__m256i d = _mm256_sub_epi8(c, zero_char);
+			__m256i l = _mm256_sub_epi8(_mm256_or_si256(c, lower), a_char);
+			__m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+			__m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(l, five), l);
+			valid &= _mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) == -1;
+			v[h] = _mm256_blendv_epi8(_mm256_add_epi8(l, ten), d, is_digit);
+			v[h] = _mm256_maddubs_epi16(v[h], weights);
+		}
+		if(!valid){
+			break;
+		}
+		//packus works per 128 bit lane, the permute puts the four quarters back in order
+		_mm256_storeu_si256((__m256i*) (out + done/2), _mm256_permute4x64_epi64(_mm256_packus_epi16(v[0], v[1]), 0xd8));
+	}
+	return done;
+}
+
+__attribute__((target("ssse3")))
+long hexEncodeSsse3(const unsigned char* in, long len, unsigned char* out){
+	const __m128i digits = _mm_loadu_si128((const __m128i*) hex_digits);
+	const __m128i low_nibble = _mm_set1_epi8(0x0f);
+	long done = 0;
+	for(; done + 16 <= len; done += 16){
+		__m128i x = _mm_loadu_si128((const __m128i*) (in + done));
+		__m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), low_nibble));
+		__m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(x, low_nibble));
+		_mm_storeu_si128((__m128i*) (out + 2*done), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*) (out + 2*done + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return done;
+}
+
+__attribute__((target("avx2")))
+long hexEncodeAvx2(const unsigned char* in, long len, unsigned char* out){
+	const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hex_digits));
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	long done = 0;
+	for(; done + 32 <= len; done += 32){
+		//quarters 0 2 1 3, so the in-lane unpacks come out in order
+		__m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*) (in + done)), 0xd8);
+		__m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibble));
+		__m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, low_nibble));
+		_mm256_storeu_si256((__m256i*) (out + 2*done), _mm256_unpacklo_epi8(hi, lo));
+		_mm256_storeu_si256((__m256i*) (out + 2*done + 32), _mm256_unpackhi_epi8(hi, lo));
+	}
+	return done;
+}
+
+/* 16 characters to 12 bytes a step. Writes 4 bytes past the last step */
+__attribute__((target("ssse3")))
+long base64DecodeSsse3(const unsigned char* in, long len, unsigned char* out){
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	const __m128i gather = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	long done = 0;
+	for(; done + 16 <= len; done += 16){
+		__m128i c = _mm_loadu_si128((const __m128i*) (in + done));
+		__m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(c, 4), mask_2f);
+		__m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(c, mask_2f));
+		__m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff){
+			break;
+		}
+		__m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(c, mask_2f), hi_nibbles));
+		__m128i v = _mm_add_epi8(c, roll);
+		//four 6 bit values to three bytes, per 32 bit group
+		v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+		v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i*) (out + done/16*12), _mm_shuffle_epi8(v, gather));
+	}
+	return done;
+}
+
+/* 12 bytes to 16 characters a step. Reads 4 bytes past the last step, so it stops 4 bytes early */
+__attribute__((target("ssse3")))
+long base64EncodeSsse3(const unsigned char* in, long len, unsigned char* out){
+	const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	long done = 0;
+	for(; done + 16 <= len; done += 12){
+		__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (in + done)), spread);
+		__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(x, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		__m128i t1 = _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		__m128i indices = _mm_or_si128(t0, t1);
+		//index to character: pick the offset for its range
+		__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+		_mm_storeu_si128((__m128i*) (out + done/12*16), _mm_add_epi8(_mm_shuffle_epi8(shift, range), indices));
+	}
+	return done;
+}
+#endif
+
+int selectSsse3(){
+#ifdef HAVE_AESNI_PATH
+	return __builtin_cpu_supports("ssse3");
+#else
+	return 0;
+#endif
+}
+
+int selectAvx2(){
+#ifdef HAVE_AESNI_PATH
+	return __builtin_cpu_supports("avx2");
+#else
+	return 0;
+#endif
+}
+int use_ssse3 = selectSsse3();
+int use_avx2 = selectAvx2();
+
+/* Decode len characters, carrying a partial group to the next call. Returns the bytes written, out needs room
+   for len + 16 bytes. Sets c->error on a character that does not belong */
+long codecDecode(TextCodec* c, const unsigned char* in, long len, unsigned char* out){
+	long produced = 0;
+	long i = 0;
+	int group = c->kind == CODEC_HEX ? 2 : 4;
+	while(i < len && !c->error){
+#ifdef HAVE_AESNI_PATH
+		if(c->pending_len == 0 && !c->ended && use_ssse3){
+			long taken;
+			if(c->kind == CODEC_HEX){
+				taken = use_avx2 ? hexDecodeAvx2(in + i, len - i, out + produced) : 0;
+				taken += hexDecodeSsse3(in + i + taken, len - i - taken, out + produced + taken/2);
+				produced += taken/2;
+			}
+			else{
+				taken = base64DecodeSsse3(in + i, len - i, out + produced);
+				produced += taken/4*3;
+			}
+			i += taken;
+			if(i == len){
+				break;
+			}
+		}
+#endif
+		//one character at a time past whatever stopped the vector kernel, up to the next group boundary
+		int passed = 0;
+		do{
+			unsigned char ch = in[i++];
+			if(ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t'){
+				passed = 1;
+				continue;
+			}
+			if(c->kind == CODEC_BASE64 && ch == '='){
+				passed = 1;
+				if(c->ended && c->pad_needed > 0){
+					c->pad_needed--;
+				}
+				else if(!c->ended && c->pending_len >= 2){
+					//"xx==" carries one byte, "xxx=" two
+					unsigned char* v = c->pending;
+					out[produced++] = (unsigned char) ((v[0] << 2) | (v[1] >> 4));
+					if(c->pending_len == 3){
+						out[produced++] = (unsigned char) ((v[1] << 4) | (v[2] >> 2));
+					}
+					c->pad_needed = 3 - c->pending_len;
+					c->pending_len = 0;
+					c->ended = 1;
+				}
+				else{
+					c->error = 1;
+				}
+				continue;
+			}
+			int value = codec_values[c->kind][ch];
+			if(value < 0 || c->ended){
+				c->error = 1;
+				break;
+			}
+			c->pending[c->pending_len++] = (unsigned char) value;
+			if(c->pending_len == group){
+				unsigned char* v = c->pending;
+				if(c->kind == CODEC_HEX){
+					out[produced++] = (unsigned char) ((v[0] << 4) | v[1]);
+				}
+				else{
+					out[produced++] = (unsigned char) ((v[0] << 2) | (v[1] >> 4));
+					out[produced++] = (unsigned char) ((v[1] << 4) | (v[2] >> 2));
+					out[produced++] = (unsigned char) ((v[2] << 6) | v[3]);
+				}
+				c->pending_len = 0;
+			}
+		} while(i < len && (c->pending_len != 0 || !passed) && !c->error);
+	}
+	return produced;
+}
+
+/* 0 if the text ended on a whole group (with its padding), -1 otherwise */
+int codecDecodeFinal(TextCodec* c){
+	return c->error || c->pending_len != 0 || c->pad_needed != 0 ? -1 : 0;
+}
+
+/* Encode len bytes, base64 carries up to two bytes to the next call. Returns the characters written, out
+   needs room for 2*len + 16 characters */
+long codecEncode(TextCodec* c, const unsigned char* in, long len, unsigned char* out){
+	long written = 0;
+	if(c->kind == CODEC_HEX){
+		long i = 0;
+#ifdef HAVE_AESNI_PATH
+		if(use_avx2){
+			i = hexEncodeAvx2(in, len, out);
+		}
+		if(use_ssse3){
+			i += hexEncodeSsse3(in + i, len - i, out + 2*i);
+		}
+#endif
+		for(; i < len; ++i){
+			out[2*i] = hex_digits[in[i] >> 4];
+			out[2*i + 1] = hex_digits[in[i] & 15];
+		}
+		return 2*len;
+	}
+	//complete a group left over from the last call
+	while(c->pending_len > 0 && c->pending_len < 3 && len > 0){
+		c->pending[c->pending_len++] = *in++;
+		len--;
+	}
+	if(c->pending_len == 3){
+		unsigned char* p = c->pending;
+		out[written++] = base64_digits[p[0] >> 2];
+		out[written++] = base64_digits[((p[0] & 3) << 4) | (p[1] >> 4)];
+		out[written++] = base64_digits[((p[1] & 15) << 2) | (p[2] >> 6)];
+		out[written++] = base64_digits[p[2] & 63];
+		c->pending_len = 0;
+	}
+	long i = 0;
+#ifdef HAVE_AESNI_PATH
+	if(use_ssse3){
+		i = base64EncodeSsse3(in, len, out + written);
+		written += i/3*4;
+	}
+#endif
+	for(; i + 3 <= len; i += 3){
+		out[written++] = base64_digits[in[i] >> 2];
+		out[written++] = base64_digits[((in[i] & 3) << 4) | (in[i + 1] >> 4)];
+		out[written++] = base64_digits[((in[i + 1] & 15) << 2) | (in[i + 2] >> 6)];
+		out[written++] = base64_digits[in[i + 2] & 63];
+	}
+	for(; i < len; ++i){
+		c->pending[c->pending_len++] = in[i];
+	}
+	return written;
+}
+
+/* The last partial base64 group with its padding, then a newline. out needs room for 5 characters */
+long codecEncodeFinal(TextCodec* c, unsigned char* out){
+	long written = 0;
+	if(c->kind == CODEC_BASE64 && c->pending_len > 0){
+		unsigned char* p = c->pending;
+		unsigned char second = c->pending_len > 1 ? p[1] : 0;
+		out[written++] = base64_digits[p[0] >> 2];
+		out[written++] = base64_digits[((p[0] & 3) << 4) | (second >> 4)];
+		out[written++] = c->pending_len > 1 ? base64_digits[(second & 15) << 2] : '=';
+		out[written++] = '=';
+		c->pending_len = 0;
+	}
+	out[written++] = '\n';
+	return written;
+}
+
+/* Read exactly len bytes given as text in the codec, one character at a time, for the key and the IV.
+   Returns 0, or -1 on bad text or end of input */
+int readText(int fd, int kind, unsigned char* out, long len){
+	TextCodec c;
+	codecInit(&c, kind);
+	unsigned char buf[16];
+	long got = 0;
+	while(got < len || c.pending_len != 0 || c.pad_needed != 0){
+		unsigned char ch;
+		if(readFull(fd, &ch, 1) != 1){
+			return -1;
+		}
+		long n = codecDecode(&c, &ch, 1, buf);
+		if(c.error || got + n > len){
+			return -1;
+		}
+		memcpy(out + got, buf, n);
+		got += n;
+	}
+	return 0;
+}
+
+/* runStream with text on both sides. Each TEXT_SLICE of text is decoded, run through the stream and encoded
+   before the next, while all three are in cache */
+int runText(BlockStream* s, int in_fd, int out_fd, int kind){
+	TextCodec decoder, encoder;
+	codecInit(&decoder, kind);
+	codecInit(&encoder, kind);
+	unsigned char* text_in = allocAligned(IO_BUFFER);
+	unsigned char* text_out = allocAligned(2*IO_BUFFER + IO_ALIGN);
+	unsigned char* plain = allocAligned(TEXT_SLICE + IO_ALIGN);
+	unsigned char* cipher = allocAligned(TEXT_SLICE + IO_ALIGN);
+	int result = RUN_OK;
+	long got;
+	do{
+		got = readFull(in_fd, text_in, IO_BUFFER);
+		if(got < 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		long out_len = 0;
+		for(long off = 0; off < got; off += TEXT_SLICE){
+			long n = got - off < TEXT_SLICE ? got - off : TEXT_SLICE;
+			long bytes = codecDecode(&decoder, text_in + off, n, plain);
+			long ciphered = streamUpdate(s, plain, bytes, cipher);
+			out_len += codecEncode(&encoder, cipher, ciphered, text_out + out_len);
+		}
+		if(decoder.error){
+			result = RUN_BAD_TEXT;
+			break;
+		}
+		if(writeFull(out_fd, text_out, out_len) != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+	} while(got == IO_BUFFER);
+	if(result == RUN_OK){
+		long written = streamFinal(s, cipher);
+		if(codecDecodeFinal(&decoder) != 0){
+			result = RUN_BAD_TEXT;
+		}
+		else if(written < 0){
+			result = RUN_STREAM_ERROR;
+		}
+		else{
+			long out_len = codecEncode(&encoder, cipher, written, text_out);
+			out_len += codecEncodeFinal(&encoder, text_out + out_len);
+			if(writeFull(out_fd, text_out, out_len) != 0){
+				result = RUN_IO_ERROR;
+			}
+		}
+	}
+	free(text_in);
+	free(text_out);
+	free(plain);
+	free(cipher);
+	return result;
+}
+
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+#define HAVE_VMSPLICE 1
+/* ---------- vmsplice into a pipe ----------
+   When stdout is a pipe the ciphertext pages are handed to it with vmsplice instead of being copied by write.
+   The pipe then references our pages, and so does anything the reader splices them on to (a socket, a file),
+   for as long as it likes, so a page that went into the pipe can never be written again. Every buffer is
+   therefore a fresh anonymous mapping that is gifted to the pipe (SPLICE_F_GIFT) and unmapped right after:
+   the kernel keeps the pages alive for the pipe and nothing in this process can reach them anymore */
+int vmspliceAll(int fd, unsigned char* buf, long len){
+	while(len > 0){
+		struct iovec iov;
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		ssize_t w = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+		if(w < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+int runSplice(BlockStream* s, int in_fd, int out_fd){
+	fcntl(out_fd, F_SETPIPE_SZ, 1 << 20); //as large as allowed, the default is 64 KiB
+	long pipe_size = fcntl(out_fd, F_GETPIPE_SZ);
+	if(pipe_size <= 0 || pipe_size % IO_ALIGN != 0){
+		return runStream(s, in_fd, out_fd);
+	}
+	unsigned char* in_buf = allocAligned(pipe_size);
+	long out_size = pipe_size + IO_ALIGN;
+	unsigned char tail[32];
+	int result = RUN_OK;
+	long got;
+	do{
+		got = readFull(in_fd, in_buf, pipe_size);
+		if(got < 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		void* out_buf = mmap(NULL, out_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if(out_buf == MAP_FAILED){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		long written = streamUpdate(s, in_buf, got, (unsigned char*) out_buf);
+		int spliced = vmspliceAll(out_fd, (unsigned char*) out_buf, written);
+		munmap(out_buf, out_size); //the pipe keeps the gifted pages, this process never sees them again
+		if(spliced != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+	} while(got == pipe_size);
+	if(result == RUN_OK){
+		long written = streamFinal(s, tail);
+		if(written < 0){
+			result = RUN_STREAM_ERROR;
+		}
+		else if(writeFull(out_fd, tail, written) != 0){
+			result = RUN_IO_ERROR;
+		}
+	}
+	free(in_buf);
+	return result;
+}
+#endif
+
+/* ---------- Memory mapped files ----------
+   For a regular input file and an output file that can be mapped. The output is sized up front with ftruncate,
+   and the input and output are mapped one MAP_WINDOW at a time, so the bulk kernel reads straight out of the page
+   cache and writes straight into it. Address space use stays at two windows whatever the file size. The output is
+   trimmed to its real length at the end, padding and stealing only change the last 32 bytes. A failed run is
+   trimmed to what it produced, so no unwritten tail is left behind */
+#define MAP_WINDOW (64L << 20)
+
+int runMapped(BlockStream* s, int in_fd, int out_fd){
+	struct stat st;
+	if(fstat(in_fd, &st) != 0){
+		return RUN_IO_ERROR;
+	}
+	long size = st.st_size;
+	long page = sysconf(_SC_PAGESIZE);
+	long out_pos = 0;
+	int result = RUN_OK;
+	if(ftruncate(out_fd, size + 32) != 0){
+		return RUN_IO_ERROR;
+	}
+	for(long off = 0; off < size; off += MAP_WINDOW){
+		long n = size - off < MAP_WINDOW ? size - off : MAP_WINDOW;
+		long out_base = out_pos & ~(page - 1);
+		long out_len = out_pos - out_base + n + 16;
+		void* in_map = mmap(NULL, n, PROT_READ, MAP_SHARED, in_fd, off);
+		if(in_map == MAP_FAILED){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		madvise(in_map, n, MADV_SEQUENTIAL);
+		void* out_map = mmap(NULL, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, out_base);
+		if(out_map == MAP_FAILED){
+			munmap(in_map, n);
+			result = RUN_IO_ERROR;
+			break;
+		}
+		out_pos += streamUpdate(s, (unsigned char*) in_map, n, (unsigned char*) out_map + (out_pos - out_base));
+		munmap(in_map, n);
+		munmap(out_map, out_len);
+	}
+	unsigned char tail[32];
+	long written = result == RUN_OK ? streamFinal(s, tail) : 0;
+	if(result != RUN_OK || written < 0){
+		//never leave the unwritten part of the presized output behind
+		if(ftruncate(out_fd, out_pos) != 0){
+			return RUN_IO_ERROR;
+		}
+		return result != RUN_OK ? result : RUN_STREAM_ERROR;
+	}
+	if(pwrite(out_fd, tail, written, out_pos) != written || ftruncate(out_fd, out_pos + written) != 0){
+		return RUN_IO_ERROR;
+	}
+	return RUN_OK;
+}
+
+/* ---------- O_DIRECT ----------
+   Bypasses the page cache so bulk jobs leave the cache to the services sharing the host. O_DIRECT wants buffers,
+   offsets and lengths in whole IO_ALIGN units: the buffers come from allocAligned, reads ask for whole units and
+   simply come back short at end of file, and the output is cut at the last whole unit of each slot with the
+   rest carried into the next one. Only the final piece is written through the cache. Several reads and writes
+   are kept in flight by the io_uring driver */
+void directOff(int fd){
+	int flags = fcntl(fd, F_GETFL);
+	if(flags >= 0 && (flags & O_DIRECT)){
+		fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+	}
+}
+
+long directLength(long len){
+	return (len + IO_ALIGN - 1) & ~(IO_ALIGN - 1);
+}
+
+#ifdef HAVE_IO_URING
+/* ---------- io_uring ----------
+   Raw syscalls, no liburing. URING_SLOTS slots each own a registered input and output buffer and go
+   FREE -> READING -> READ -> PROCESSED -> WRITING -> FREE. Reads are queued ahead while earlier slots are being
+   encrypted and written, so the device stays busy during compute. Slots are encrypted strictly in order because
+   the stream carries CBC and padding state from one buffer to the next. Regular files use explicit offsets and
+   keep every slot in flight; pipes and terminals have no offsets, so there only one read and one write are
+   outstanding at a time, which still overlaps both with the cipher */
+#define URING_SLOTS 8
+#define URING_BUFFER (1L << 20)
+
+#define SLOT_FREE 0
+#define SLOT_READING 1
+#define SLOT_READ 2
+#define SLOT_PROCESSED 3
+#define SLOT_WRITING 4
+
+struct UringSlot {
+	unsigned char* in;
+	unsigned char* out;
+	int state;
+	long off;        //file offset of the read (or of the write, once processed)
+	long want;       //bytes the read asks for
+	long fill;       //bytes read so far
+	long out_len;
+	long out_done;
+};
+
+struct Uring {
+	int fd;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sq_map;
+	long sq_map_len;
+	void* cq_map;
+	long cq_map_len;
+	long sqe_map_len;
+	unsigned pending;    //queued but not yet passed to io_uring_enter
+};
+
+/* Returns 0, or -1 if the kernel has no usable io_uring */
+int uringInit(Uring* ring, unsigned entries){
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+	if(ring->fd < 0){
+		return -1;
+	}
+	ring->sq_map_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	ring->cq_map_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	ring->sqe_map_len = p.sq_entries*sizeof(struct io_uring_sqe);
+	ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED){
+		close(ring->fd);
+		return -1;
+	}
+	unsigned char* sq = (unsigned char*) ring->sq_map;
+	unsigned char* cq = (unsigned char*) ring->cq_map;
+	ring->sq_head = (unsigned*) (sq + p.sq_off.head);
+	ring->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) (sq + p.sq_off.array);
+	ring->cq_head = (unsigned*) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+	ring->pending = 0;
+	return 0;
+}
+
+void uringFree(Uring* ring){
+	munmap(ring->sqes, ring->sqe_map_len);
+	munmap(ring->cq_map, ring->cq_map_len);
+	munmap(ring->sq_map, ring->sq_map_len);
+	close(ring->fd);
+}
+
+/* Queue a fixed buffer read or write, user_data is the slot */
+void uringQueue(Uring* ring, int op, int fd, unsigned char* buf, long len, long off, int buf_index, int slot){
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = ring->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (unsigned char) op;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) buf;
+	sqe->len = (unsigned) len;
+	sqe->off = (unsigned long long) off;
+	sqe->buf_index = (unsigned short) buf_index;
+	sqe->user_data = (unsigned long long) slot;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->pending++;
+}
+
+/* With direct set, in_fd and out_fd are open with O_DIRECT: see runDirect */
+int runUring(BlockStream* s, int in_fd, int out_fd, int direct){
+	Uring ring;
+	if(uringInit(&ring, 2*URING_SLOTS) != 0){
+		directOff(in_fd);
+		directOff(out_fd);
+		return runStream(s, in_fd, out_fd);
+	}
+	UringSlot slots[URING_SLOTS];
+	struct iovec iov[2*URING_SLOTS];
+	unsigned char* in_mem = allocAligned(URING_BUFFER*URING_SLOTS);
+	unsigned char* out_mem = allocAligned((URING_BUFFER + 2*IO_ALIGN)*URING_SLOTS);
+	for(int i = 0; i < URING_SLOTS; ++i){
+		slots[i].in = in_mem + URING_BUFFER*i;
+		slots[i].out = out_mem + (URING_BUFFER + 2*IO_ALIGN)*i;
+		slots[i].state = SLOT_FREE;
+		iov[i].iov_base = slots[i].in;
+		iov[i].iov_len = URING_BUFFER;
+		iov[URING_SLOTS + i].iov_base = slots[i].out;
+		iov[URING_SLOTS + i].iov_len = URING_BUFFER + 2*IO_ALIGN;
+	}
+	if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov, 2*URING_SLOTS) != 0){
+		uringFree(&ring);
+		free(in_mem);
+		free(out_mem);
+		directOff(in_fd);
+		directOff(out_fd);
+		return runStream(s, in_fd, out_fd);
+	}
+
+	struct stat st;
+	int seek_in = fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode);
+	long in_size = seek_in ? st.st_size : 0;
+	int seek_out = fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode);
+	long out_start = seek_out ? lseek(out_fd, 0, SEEK_CUR) : 0;
+	long read_off = seek_in ? lseek(in_fd, 0, SEEK_CUR) : 0;
+	long out_pos = out_start;
+	long seq_read = 0, seq_proc = 0, seq_write = 0;
+	int reads_out = 0, writes_out = 0;
+	int input_done = seek_in && read_off >= in_size;
+	unsigned char carry[IO_ALIGN]; //direct: output past the last whole IO_ALIGN, moved to the front of the next slot
+	long carry_len = 0;
+	int result = RUN_OK;
+	while(result == RUN_OK){
+		//queue reads into free slots, in sequence order
+		while(!input_done && slots[seq_read % URING_SLOTS].state == SLOT_FREE && (seek_in || reads_out == 0)){
+			int i = (int) (seq_read % URING_SLOTS);
+			slots[i].fill = 0;
+			slots[i].off = seek_in ? read_off : -1;
+			slots[i].want = seek_in && in_size - read_off < URING_BUFFER ? in_size - read_off : URING_BUFFER;
+			uringQueue(&ring, IORING_OP_READ_FIXED, in_fd, slots[i].in, direct ? directLength(slots[i].want) : slots[i].want, slots[i].off, i, i);
+			slots[i].state = SLOT_READING;
+			reads_out++;
+			seq_read++;
+			if(seek_in){
+				read_off += slots[i].want;
+				input_done = read_off >= in_size;
+			}
+		}
+		//encrypt completed reads in order, the device keeps working on the queued requests meanwhile
+		while(seq_proc < seq_read && slots[seq_proc % URING_SLOTS].state == SLOT_READ){
+			UringSlot* slot = slots + seq_proc % URING_SLOTS;
+			if(direct){
+				memcpy(slot->out, carry, carry_len);
+				slot->out_len = carry_len + streamUpdate(s, slot->in, slot->fill, slot->out + carry_len);
+				carry_len = slot->out_len % IO_ALIGN;
+				slot->out_len -= carry_len;
+				memcpy(carry, slot->out + slot->out_len, carry_len);
+			}
+			else{
+				slot->out_len = streamUpdate(s, slot->in, slot->fill, slot->out);
+			}
+			slot->out_done = 0;
+			slot->off = seek_out ? out_pos : -1;
+			out_pos += slot->out_len;
+			slot->state = slot->out_len > 0 ? SLOT_PROCESSED : SLOT_FREE;
+			seq_proc++;
+		}
+		//write processed slots in order
+		while(seq_write < seq_proc && (seek_out || writes_out == 0)){
+			int i = (int) (seq_write % URING_SLOTS);
+			if(slots[i].state == SLOT_PROCESSED){
+				uringQueue(&ring, IORING_OP_WRITE_FIXED, out_fd, slots[i].out, slots[i].out_len, slots[i].off, URING_SLOTS + i, i);
+				slots[i].state = SLOT_WRITING;
+				writes_out++;
+			}
+			else if(slots[i].state != SLOT_FREE){
+				break;
+			}
+			seq_write++;
+		}
+		if(reads_out == 0 && writes_out == 0 && ring.pending == 0){
+			if(input_done && seq_proc == seq_read){
+				break;
+			}
+			continue;
+		}
+		long submitted = syscall(__NR_io_uring_enter, ring.fd, ring.pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(submitted < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			result = RUN_IO_ERROR;
+			break;
+		}
+		ring.pending -= (unsigned) submitted;
+		unsigned head = *ring.cq_head;
+		while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)){
+			struct io_uring_cqe* cqe = ring.cqes + (head & *ring.cq_mask);
+			UringSlot* slot = slots + cqe->user_data;
+			int i = (int) cqe->user_data;
+			int res = cqe->res;
+			head++;
+			if(res < 0 && res != -EINTR && res != -EAGAIN){
+				result = RUN_IO_ERROR;
+				break;
+			}
+			if(res < 0){
+				res = 0; //retried below as a short transfer
+			}
+			if(slot->state == SLOT_READING){
+				slot->fill += res;
+				if(slot->fill > slot->want){
+					slot->fill = slot->want; //the file grew past the aligned length, the rest is a later slot's
+				}
+				if(cqe->res == 0){
+					input_done = 1; //end of input, a file that shrank ends early too
+				}
+				else if(seek_in && slot->fill < slot->want){
+					if(direct){
+						slot->fill &= ~(long) (IO_ALIGN - 1); //O_DIRECT only takes aligned requests, the overlap is read again
+					}
+					uringQueue(&ring, IORING_OP_READ_FIXED, in_fd, slot->in + slot->fill,
+							direct ? directLength(slot->want - slot->fill) : slot->want - slot->fill, slot->off + slot->fill, i, i);
+					continue;
+				}
+				slot->state = SLOT_READ; //a short read from a pipe is handed on as it is
+				reads_out--;
+			}
+			else{
+				slot->out_done += res;
+				if(slot->out_done < slot->out_len){
+					if(direct){
+						slot->out_done &= ~(long) (IO_ALIGN - 1); //out_len is a whole IO_ALIGN, the overlap is written again
+					}
+					uringQueue(&ring, IORING_OP_WRITE_FIXED, out_fd, slot->out + slot->out_done, slot->out_len - slot->out_done,
+							slot->off < 0 ? -1 : slot->off + slot->out_done, URING_SLOTS + i, i);
+					continue;
+				}
+				slot->state = SLOT_FREE;
+				writes_out--;
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	if(result == RUN_OK){
+		//carried bytes and what streamFinal adds are not a whole IO_ALIGN, they go through the page cache
+		unsigned char tail[IO_ALIGN + 32];
+		memcpy(tail, carry, carry_len);
+		long written = streamFinal(s, tail + carry_len);
+		if(written < 0){
+			result = RUN_STREAM_ERROR;
+			written = 0;
+		}
+		written += carry_len;
+		if(direct){
+			directOff(out_fd);
+		}
+		if((seek_out ? pwrite(out_fd, tail, written, out_pos) : write(out_fd, tail, written)) != written){
+			result = RUN_IO_ERROR;
+		}
+		else if(seek_out){
+			lseek(out_fd, out_pos + written, SEEK_SET);
+		}
+	}
+	uringFree(&ring);
+	free(in_mem);
+	free(out_mem);
+	return result;
+}
+/* Both must be regular files. Where the file system refuses O_DIRECT this is a normal io_uring run */
+int runDirect(BlockStream* s, int in_fd, int out_fd){
+	int in_flags = fcntl(in_fd, F_GETFL);
+	int out_flags = fcntl(out_fd, F_GETFL);
+	if(fcntl(in_fd, F_SETFL, in_flags | O_DIRECT) != 0 || fcntl(out_fd, F_SETFL, out_flags | O_DIRECT) != 0){
+		directOff(in_fd);
+		return runUring(s, in_fd, out_fd, 0);
+	}
+	return runUring(s, in_fd, out_fd, 1);
+}
+#endif
+
+/* ---------- Reader / cipher / writer pipeline ----------
+   A reader thread fills PIPE_BUFFER byte buffers, cipher threads encrypt them and a writer thread writes them
+   out, so reading, the cipher and writing all run at once. Stages only talk through single producer single
+   consumer rings: buffer k goes from the reader to cipher thread k % threads and from there to the writer, which
+   takes the rings in the same rotation, so the output keeps the input order. Empty buffers go back from the writer
+   to the reader through one more ring. Every buffer but the last is full, so all of them are whole blocks.
+   ECB and CBC decryption need nothing from the previous buffer but its last 48 input bytes: the bytes the
+   stream would still hold (up to 32 for stealing or padding) and the ciphertext block before them as CBC
+   chaining value. Each buffer carries those, and the cipher threads run independently. CBC encryption chains
+   on its own output, so it runs one cipher thread with the stream itself */
+#define PIPE_BUFFER (1L << 20)
+#define PIPE_TAIL 48
+
+struct PipeBuffer {
+	unsigned char* in;
+	unsigned char* out;      //PIPE_BUFFER + IO_ALIGN bytes, held bytes and streamFinal add up to 64
+	long len;
+	long out_len;
+	long before;             //input bytes ahead of this buffer
+	unsigned char prior[PIPE_TAIL]; //the last PIPE_TAIL of them, right aligned
+	int final;
+	int status;              //RUN_* code
+};
+
+/* Lock free ring, one thread pushes and one pops. cap is a power of two */
+struct SpscRing {
+	PipeBuffer** items;
+	unsigned long cap;
+	unsigned long head;      //next pop, written by the consumer
+	unsigned long tail;      //next push, written by the producer
+};
+
+void ringInit(SpscRing* r, unsigned long cap){
+	r->items = new PipeBuffer*[cap];
+	r->cap = cap;
+	r->head = 0;
+	r->tail = 0;
+}
+
+void ringPush(SpscRing* r, PipeBuffer* b){
+	unsigned long tail = r->tail;
+	while(tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->cap){
+		std::this_thread::yield();
+	}
+	r->items[tail & (r->cap - 1)] = b;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+PipeBuffer* ringPop(SpscRing* r){
+	unsigned long head = r->head;
+	while(__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head){
+		std::this_thread::yield();
+	}
+	PipeBuffer* b = r->items[head & (r->cap - 1)];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return b;
+}
+
+struct Pipeline {
+	BlockStream* stream;     //settings, and the running state when there is a single sequential cipher thread
+	int parallel;
+	int threads;
+	int in_fd;
+	int out_fd;
+	SpscRing free_ring;
+	SpscRing* work;          //reader to cipher thread t
+	SpscRing* done;          //cipher thread t to writer
+	int stop;                //set by the writer after a write error
+};
+
+void pipeReader(Pipeline* p){
+	unsigned char tail[PIPE_TAIL] = {0};
+	long before = 0;
+	for(long k = 0; ; ++k){
+		PipeBuffer* b = ringPop(&p->free_ring);
+		b->before = before;
+		memcpy(b->prior, tail, PIPE_TAIL);
+		b->len = __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) ? 0 : readFull(p->in_fd, b->in, PIPE_BUFFER);
+		b->status = b->len < 0 ? RUN_IO_ERROR : RUN_OK;
+		if(b->len < 0){
+			b->len = 0;
+		}
+		b->final = b->len < PIPE_BUFFER;
+		//slide the last PIPE_TAIL input bytes along
+		long keep = PIPE_TAIL - b->len > 0 ? PIPE_TAIL - b->len : 0;
+		memmove(tail, tail + PIPE_TAIL - keep, keep);
+		memcpy(tail + keep, b->in + b->len - (PIPE_TAIL - keep), PIPE_TAIL - keep);
+		before += b->len;
+		ringPush(p->work + k % p->threads, b);
+		if(b->final){
+			for(int t = 0; t < p->threads; ++t){
+				ringPush(p->work + t, NULL); //no more work
+			}
+			return;
+		}
+	}
+}
+
+void pipeCipher(Pipeline* p, int t){
+	for(;;){
+		PipeBuffer* b = ringPop(p->work + t);
+		if(b == NULL){
+			return;
+		}
+		BlockStream local;
+		BlockStream* s = p->stream;
+		if(p->parallel){
+			//rebuild the state the stream would have after b->before bytes
+			s = &local;
+			streamInit(s, p->stream->expanded_key, p->stream->mode, p->stream->decrypt, p->stream->pad, p->stream->cts, p->stream->iv);
+			long keep = streamKeep(s, b->before);
+			memcpy(s->held, b->prior + PIPE_TAIL - keep, keep);
+			s->held_len = (int) keep;
+			if(b->before - keep >= 16){
+				memcpy(s->iv, b->prior + PIPE_TAIL - keep - 16, 16);
+			}
+		}
+		b->out_len = streamUpdate(s, b->in, b->len, b->out);
+		if(b->final && b->status == RUN_OK){
+			long written = streamFinal(s, b->out + b->out_len);
+			if(written < 0){
+				b->status = RUN_STREAM_ERROR;
+			}
+			else{
+				b->out_len += written;
+			}
+		}
+		ringPush(p->done + t, b);
+	}
+}
+
+int pipeWriter(Pipeline* p){
+	int result = RUN_OK;
+	for(long k = 0; ; ++k){
+		PipeBuffer* b = ringPop(p->done + k % p->threads);
+		if(result == RUN_OK && writeFull(p->out_fd, b->out, b->out_len) != 0){
+			result = RUN_IO_ERROR;
+			__atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+		}
+		if(result == RUN_OK){
+			result = b->status;
+		}
+		if(b->final){
+			return result;
+		}
+		ringPush(&p->free_ring, b);
+	}
+}
+
+int runPipeline(BlockStream* s, int in_fd, int out_fd, int threads){
+	Pipeline p;
+	p.stream = s;
+	p.parallel = !(s->mode == STREAM_CBC && !s->decrypt);
+	p.threads = p.parallel ? threads : 1;
+	p.in_fd = in_fd;
+	p.out_fd = out_fd;
+	p.stop = 0;
+	int count = 2*p.threads + 2; //every stage has a buffer to work on and one queued
+	unsigned long cap = 1;
+	while(cap < (unsigned long) count + 1){
+		cap <<= 1;
+	}
+	ringInit(&p.free_ring, cap);
+	p.work = new SpscRing[p.threads];
+	p.done = new SpscRing[p.threads];
+	for(int t = 0; t < p.threads; ++t){
+		ringInit(p.work + t, cap);
+		ringInit(p.done + t, cap);
+	}
+	PipeBuffer* buffers = new PipeBuffer[count];
+	unsigned char* in_mem = allocAligned(PIPE_BUFFER*count);
+	unsigned char* out_mem = allocAligned((PIPE_BUFFER + IO_ALIGN)*count);
+	for(int i = 0; i < count; ++i){
+		buffers[i].in = in_mem + PIPE_BUFFER*i;
+		buffers[i].out = out_mem + (PIPE_BUFFER + IO_ALIGN)*i;
+		ringPush(&p.free_ring, buffers + i);
+	}
+	std::thread reader(pipeReader, &p);
+	std::vector<std::thread> ciphers;
+	for(int t = 0; t < p.threads; ++t){
+		ciphers.push_back(std::thread(pipeCipher, &p, t));
+	}
+	int result = pipeWriter(&p);
+	reader.join();
+	for(int t = 0; t < p.threads; ++t){
+		ciphers[t].join();
+	}
+	for(int t = 0; t < p.threads; ++t){
+		delete[] p.work[t].items;
+		delete[] p.done[t].items;
+	}
+	delete[] p.free_ring.items;
+	delete[] p.work;
+	delete[] p.done;
+	delete[] buffers;
+	free(in_mem);
+	free(out_mem);
+	return result;
+}
+
+/* ---------- In place with a progress journal ----------
+   Encrypts or decrypts a file where it is, INPLACE_CHUNK bytes at a time with pread and pwrite. Only modes that
+   keep the length work this way: ECB or CBC on whole blocks, or with ciphertext stealing. A journal next to the
+   file (path + ".journal") makes every chunk all or nothing across a crash:
+     1. what is needed to finish or undo the chunk goes to the journal, marked pending, and is synced
+     2. the chunk is written and synced
+     3. the journal is moved on to the new offset and the chaining value there, and synced
+   Step 1 saves the original bytes the chunk is about to overwrite, and a run that finds a pending journal puts
+   them back before resuming from the recorded offset. ECB on whole blocks maps every block on its own, so there
+   step 1 also records a fingerprint of the result for each JOURNAL_SECTOR of the chunk: if every sector already
+   holds its result the chunk is taken as done and the restore is skipped. Any other state, torn sectors
+   included, falls back to the saved bytes. Output lags input by the bytes the stream holds, and those are still
+   unmodified on disk, so the offset and the CBC chaining value are the whole state. The journal is removed
+   when the file is done */
+#define INPLACE_CHUNK (8L << 20)
+#define JOURNAL_MAGIC "AESJRNL3"
+#define JOURNAL_DATA 4096        //offset of the saved bytes, the header sits in the block before
+#define JOURNAL_SECTOR 512       //fingerprint granularity
+
+struct JournalHeader {
+	char magic[8];
+	long size;               //file size, the run never changes it
+	int mode;
+	int decrypt;
+	int cts;
+	int pending;             //1 while a chunk is being written, the journal data is valid
+	int prints;              //sector fingerprints of the result follow the saved bytes
+	long offset;             //everything before is done
+	long pending_len;
+	unsigned char iv[16];    //CBC chaining value at offset
+	unsigned char check[8];  //start of E(0), so a resume under another key is refused
+};
+
+/* The saved bytes and the fingerprints after them are synced before the header that points at them */
+int journalWrite(int fd, JournalHeader* j, const unsigned char* data, long len, const uint64_t* prints, long prints_len){
+	if(len > 0 && pwrite(fd, data, len, JOURNAL_DATA) != len){
+		return -1;
+	}
+	if(prints_len > 0 && pwrite(fd, prints, 8*prints_len, JOURNAL_DATA + len) != 8*prints_len){
+		return -1;
+	}
+	if(len + prints_len > 0 && fdatasync(fd) != 0){
+		return -1;
+	}
+	if(pwrite(fd, j, sizeof(*j), 0) != (long) sizeof(*j)){
+		return -1;
+	}
+	return fdatasync(fd);
+}
+
+/* 64 bit FNV-1a, the fingerprint of a sector */
+uint64_t sectorFingerprint(const unsigned char* p, long len){
+	uint64_t h = 14695981039346656037ULL;
+	for(long i = 0; i < len; ++i){
+		h = (h ^ p[i])*1099511628211ULL;
+	}
+	return h;
+}
+
+/* Length of the piece of a chunk at file offset pos that ends at the next sector boundary, or at end */
+long sectorPiece(long pos, long end){
+	long boundary = (pos/JOURNAL_SECTOR + 1)*JOURNAL_SECTOR;
+	return (boundary < end ? boundary : end) - pos;
+}
+
+/* Number of sector pieces in a chunk of len bytes at file offset pos */
+long sectorPieces(long pos, long len){
+	return len == 0 ? 0 : (pos + len - 1)/JOURNAL_SECTOR - pos/JOURNAL_SECTOR + 1;
+}
+
+/* Fingerprints of the result of every sector piece of the chunk at file offset pos. The pieces follow the
+   file's sectors, not the chunk's start */
+void sectorFingerprints(const unsigned char* result, long pos, long len, uint64_t* prints){
+	for(long off = 0, k = 0; off < len; ++k){
+		long n = sectorPiece(pos + off, pos + len);
+		prints[k] = sectorFingerprint(result + off, n);
+		off += n;
+	}
+}
+
+/* Whether every sector of a pending ECB chunk already fingerprints as its result, so the chunk needs neither
+   the restore nor a second pass. Any doubt, a read error included, answers 0 and leaves it to the saved bytes */
+int journalDone(int fd, int jfd, JournalHeader* j, uint64_t* prints){
+	unsigned char sector[JOURNAL_SECTOR];
+	long sectors = sectorPieces(j->offset, j->pending_len);
+	long end = j->offset + j->pending_len;
+	if(pread(jfd, prints, 8*sectors, JOURNAL_DATA + j->pending_len) != 8*sectors){
+		return 0;
+	}
+	for(long k = 0, off = j->offset; k < sectors; ++k, off += sectorPiece(off, end)){
+		long n = sectorPiece(off, end);
+		if(pread(fd, sector, n, off) != n || sectorFingerprint(sector, n) != prints[k]){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Returns RUN_OK, RUN_IO_ERROR, RUN_STREAM_ERROR if the size does not suit the mode, or RUN_BAD_JOURNAL if a
+   journal from a different file, mode or key is in the way */
+int runInPlace(BlockStream* s, const char* path){
+	int fd = open(path, O_RDWR);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0){
+		return RUN_IO_ERROR;
+	}
+	long size = st.st_size;
+	if(s->pad || (!s->cts && size % 16 != 0) || (s->cts && size > 0 && size < 16)){
+		close(fd);
+		return RUN_STREAM_ERROR;
+	}
+	std::string journal_path = std::string(path) + ".journal";
+	int jfd = open(journal_path.c_str(), O_RDWR | O_CREAT, 0600);
+	if(jfd < 0){
+		close(fd);
+		return RUN_IO_ERROR;
+	}
+	unsigned char* in_buf = allocAligned(INPLACE_CHUNK);
+	unsigned char* out_buf = allocAligned(INPLACE_CHUNK + IO_ALIGN);
+	unsigned char* saved = allocAligned(INPLACE_CHUNK + IO_ALIGN);
+	uint64_t* prints = new uint64_t[(INPLACE_CHUNK + IO_ALIGN)/JOURNAL_SECTOR + 1];
+	int result = RUN_OK;
+	unsigned char check[16] = {0};
+	encryptBlock(check, check, s->expanded_key);
+	JournalHeader j;
+	if(pread(jfd, &j, sizeof(j), 0) == (long) sizeof(j) && memcmp(j.magic, JOURNAL_MAGIC, 8) == 0){
+		//resume
+		if(j.size != size || j.mode != s->mode || j.decrypt != s->decrypt || j.cts != s->cts || memcmp(j.check, check, 8) != 0){
+			result = RUN_BAD_JOURNAL;
+		}
+		else if(j.pending && j.prints && journalDone(fd, jfd, &j, prints)){
+			//finished but not yet recorded, nothing to put back
+			j.pending = 0;
+			j.offset += j.pending_len;
+			if(journalWrite(jfd, &j, NULL, 0, NULL, 0) != 0){
+				result = RUN_IO_ERROR;
+			}
+		}
+		else if(j.pending){
+			if(pread(jfd, saved, j.pending_len, JOURNAL_DATA) != j.pending_len || pwrite(fd, saved, j.pending_len, j.offset) != j.pending_len
+					|| fdatasync(fd) != 0){
+				result = RUN_IO_ERROR;
+			}
+			j.pending = 0;
+		}
+		memcpy(s->iv, j.iv, 16);
+	}
+	else{
+		memset(&j, 0, sizeof(j));
+		memcpy(j.magic, JOURNAL_MAGIC, 8);
+		j.size = size;
+		j.mode = s->mode;
+		j.decrypt = s->decrypt;
+		j.cts = s->cts;
+		memcpy(j.iv, s->iv, 16);
+		memcpy(j.check, check, 8);
+		if(journalWrite(jfd, &j, NULL, 0, NULL, 0) != 0){
+			result = RUN_IO_ERROR;
+		}
+	}
+	long in_pos = j.offset;
+	while(result == RUN_OK && in_pos < size){
+		long n = size - in_pos < INPLACE_CHUNK ? size - in_pos : INPLACE_CHUNK;
+		if(pread(fd, in_buf, n, in_pos) != n){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		in_pos += n;
+		long written = streamUpdate(s, in_buf, n, out_buf);
+		if(in_pos == size){
+			written += streamFinal(s, out_buf + written); //the size was checked above, this cannot fail
+		}
+		//1. record what is about to be overwritten, and for ECB what each sector will hold
+		if(pread(fd, saved, written, j.offset) != written){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		j.pending = 1;
+		j.pending_len = written;
+		j.prints = s->mode == STREAM_ECB;
+		if(j.prints){
+			sectorFingerprints(out_buf, j.offset, written, prints);
+		}
+		if(journalWrite(jfd, &j, saved, written, prints, j.prints ? sectorPieces(j.offset, written) : 0) != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		//2. overwrite
+		if(pwrite(fd, out_buf, written, j.offset) != written || fdatasync(fd) != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+		//3. move on
+		j.pending = 0;
+		j.pending_len = 0;
+		j.offset += written;
+		memcpy(j.iv, s->iv, 16);
+		if(journalWrite(jfd, &j, NULL, 0, NULL, 0) != 0){
+			result = RUN_IO_ERROR;
+			break;
+		}
+	}
+	close(jfd);
+	close(fd);
+	if(result == RUN_OK){
+		unlink(journal_path.c_str());
+	}
+	free(in_buf);
+	free(out_buf);
+	free(saved);
+	delete[] prints;
+	return result;
+}
+
+/* ---------- Batch ----------
+   Many files under one expanded key, on a pool of worker threads that each take the next file from a shared
+   index. A worker holds two descriptors and two IO_BUFFERs at a time, so --threads bounds both the open files
+   (2 per worker) and the buffer memory (8 MiB per worker). Every file gets a fresh stream with the same settings
+   and IV. A line per file and a total go to stdout, failures to stderr */
+struct BatchJob {
+	std::string in;
+	std::string out;
+	long bytes;
+	double seconds;
+	int result;
+};
+
+struct Batch {
+	BlockStream* stream;     //settings only, each file runs on its own copy
+	std::vector<BatchJob> jobs;
+	long next;               //next job to take
+	std::mutex report;
+};
+
+double wallSeconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Jobs from a directory (its regular files, written to out_dir under the same name) or from a manifest with one
+   "input [output]" per line, where a missing output also goes to out_dir. Returns 0, -1 if the source cannot
+   be read or an output has nowhere to go, or -2 if out_dir is the source directory */
+int batchJobs(Batch* b, const char* source, const char* out_dir){
+	struct stat st;
+	if(stat(source, &st) != 0){
+		return -1;
+	}
+	std::vector<std::pair<std::string, std::string> > names;
+	if(S_ISDIR(st.st_mode)){
+		struct stat dst;
+		if(out_dir != NULL && stat(out_dir, &dst) == 0 && dst.st_dev == st.st_dev && dst.st_ino == st.st_ino){
+			return -2; //every output would truncate its own input
+		}
+		DIR* dir = opendir(source);
+		if(dir == NULL){
+			return -1;
+		}
+		struct dirent* entry;
+		while((entry = readdir(dir)) != NULL){
+			std::string path = std::string(source) + "/" + entry->d_name;
+			if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)){
+				names.push_back(std::make_pair(path, std::string()));
+			}
+		}
+		closedir(dir);
+	}
+	else{
+		std::ifstream manifest(source);
+		std::string line;
+		while(std::getline(manifest, line)){
+			std::istringstream fields(line);
+			std::string in, out;
+			if(fields >> in){
+				fields >> out;
+				names.push_back(std::make_pair(in, out));
+			}
+		}
+	}
+	for(size_t i = 0; i < names.size(); ++i){
+		BatchJob job;
+		job.in = names[i].first;
+		job.out = names[i].second;
+		if(job.out.empty()){
+			if(out_dir == NULL){
+				return -1;
+			}
+			size_t slash = job.in.rfind('/');
+			job.out = std::string(out_dir) + "/" + (slash == std::string::npos ? job.in : job.in.substr(slash + 1));
+		}
+		job.bytes = 0;
+		job.seconds = 0;
+		job.result = RUN_OK;
+		b->jobs.push_back(job);
+	}
+	return 0;
+}
+
+void batchWorker(Batch* b){
+	for(;;){
+		long k = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+		if(k >= (long) b->jobs.size()){
+			return;
+		}
+		BatchJob* job = &b->jobs[k];
+		double start = wallSeconds();
+		int in_fd = open(job->in.c_str(), O_RDONLY);
+		int out_fd = in_fd < 0 ? -1 : open(job->out.c_str(), O_WRONLY | O_CREAT, 0644); //truncated once it is known not to be the input
+		struct stat st, out_st;
+		if(out_fd < 0 || fstat(in_fd, &st) != 0 || fstat(out_fd, &out_st) != 0){
+			job->result = RUN_IO_ERROR;
+		}
+		else if(st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino){
+			job->result = RUN_SAME_FILE;
+		}
+		else if(ftruncate(out_fd, 0) != 0){
+			job->result = RUN_IO_ERROR;
+		}
+		else{
+			BlockStream s = *b->stream;
+			job->bytes = st.st_size;
+			job->result = runStream(&s, in_fd, out_fd);
+		}
+		if(in_fd >= 0){
+			close(in_fd);
+		}
+		if(out_fd >= 0 && close(out_fd) != 0 && job->result == RUN_OK){
+			job->result = RUN_IO_ERROR;
+		}
+		job->seconds = wallSeconds() - start;
+		std::lock_guard<std::mutex> lock(b->report);
+		if(job->result == RUN_OK){
+			printf("%s: %ld bytes in %.3f s, %.1f MB/s\n", job->in.c_str(), job->bytes, job->seconds,
+				job->seconds > 0 ? job->bytes/job->seconds/1e6 : 0.0);
+		}
+		else{
+			fprintf(stderr, "aes: %s: %s\n", job->in.c_str(), job->result == RUN_STREAM_ERROR ? "not a whole number of blocks, invalid padding or too short to steal"
+				: job->result == RUN_SAME_FILE ? "output is the input file, skipped" : "I/O error");
+		}
+	}
+}
+
+/* Returns the number of files that failed, or the negative batchJobs result if the job list could not be built */
+long runBatch(BlockStream* s, const char* source, const char* out_dir, int threads){
+	Batch b;
+	b.stream = s;
+	b.next = 0;
+	int built = batchJobs(&b, source, out_dir);
+	if(built != 0){
+		return built;
+	}
+	double start = wallSeconds();
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threads && t < (int) b.jobs.size(); ++t){
+		workers.push_back(std::thread(batchWorker, &b));
+	}
+	for(size_t t = 0; t < workers.size(); ++t){
+		workers[t].join();
+	}
+	double seconds = wallSeconds() - start;
+	long bytes = 0;
+	long failed = 0;
+	for(size_t i = 0; i < b.jobs.size(); ++i){
+		bytes += b.jobs[i].result == RUN_OK ? b.jobs[i].bytes : 0;
+		failed += b.jobs[i].result != RUN_OK;
+	}
+	printf("total: %ld files, %ld failed, %ld bytes in %.3f s, %.1f MB/s\n", (long) b.jobs.size(), failed, bytes, seconds,
+		seconds > 0 ? bytes/seconds/1e6 : 0.0);
+	return failed;
+}
+
+/* ---------- Self test ----------
+   --selftest runs the published known answer vectors of every mode, on the reference rounds and again on AES-NI
+   where the cpu has it, and prints a line per mode. The AEADs are also given a tampered tag, which they must
+   reject with the output zeroed, and the batch calls get several vectors of mixed lengths in one call */
+#define SELFTEST_MAX 4096 //bytes of the longest vector field
+
+/* Decode a hex string into out. Returns the number of bytes */
+long selftestHex(const char* hex, unsigned char* out){
+	long n = 0;
+	for(; hex[0] != 0 && hex[1] != 0; hex += 2){
+		out[n++] = (unsigned char) (codecValue(CODEC_HEX, (unsigned char) hex[0]) << 4 | codecValue(CODEC_HEX, (unsigned char) hex[1]));
+	}
+	return n;
+}
+
+/* Compare a result with its expected hex, counting and reporting a mismatch */
+void selftestExpect(const char* mode, int vector, const char* what, const unsigned char* got, long len, const char* hex, long* failed){
+	unsigned char expected[SELFTEST_MAX];
+	if(selftestHex(hex, expected) != len || memcmp(got, expected, len) != 0){
+		printf("%s vector %d: wrong %s\n", mode, vector, what);
+		(*failed)++;
+	}
+}
+
+/* Count and report a check that did not hold */
+void selftestCheck(const char* mode, int vector, const char* what, int ok, long* failed){
+	if(!ok){
+		printf("%s vector %d: %s\n", mode, vector, what);
+		(*failed)++;
+	}
+}
+
+/* An AEAD that rejected a tampered message must not have released any of it */
+int selftestZeroed(const unsigned char* out, long len){
+	unsigned char any = 0;
+	for(long i = 0; i < len; ++i){
+		any |= out[i];
+	}
+	return any == 0;
+}
+
+/* A known answer for one of the AEADs */
+struct AEADVector {
+	const char* key;
+	const char* nonce;
+	const char* ad;
+	const char* pt;
+	const char* ct;
+	const char* tag;
+};
+
+/* RFC 3610 section 8 and NIST SP 800-38C appendix C */
+static const AEADVector ccm_vectors[] = {
+	{"404142434445464748494a4b4c4d4e4f", "10111213141516", "0001020304050607", "20212223", "7162015b", "4dac255d"},
+	{"404142434445464748494a4b4c4d4e4f", "1011121314151617", "000102030405060708090a0b0c0d0e0f",
+		"202122232425262728292a2b2c2d2e2f", "d2a1f0e051ea5f62081a7792073d593d", "1fc64fbfaccd"},
+	{"404142434445464748494a4b4c4d4e4f", "101112131415161718191a1b", "000102030405060708090a0b0c0d0e0f10111213",
+		"202122232425262728292a2b2c2d2e2f3031323334353637", "e3b201a9f5b71a7a9b1ceaeccd97e70b6176aad9a4428aa5", "484392fbc1b09951"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000003020100a0a1a2a3a4a5", "0001020304050607",
+		"08090a0b0c0d0e0f101112131415161718191a1b1c1d1e", "588c979a61c663d2f066d0c2c0f989806d5f6b61dac384", "17e8d12cfdf926e0"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000004030201a0a1a2a3a4a5", "0001020304050607",
+		"08090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", "72c91a36e135f8cf291ca894085c87e3cc15c439c9e43a3b", "a091d56e10400916"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000005040302a0a1a2a3a4a5", "0001020304050607",
+		"08090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20", "51b1e5f44a197d1da46b0f8e2d282ae871e838bb64da859657", "4adaa76fbd9fb0c5"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000006050403a0a1a2a3a4a5", "000102030405060708090a0b",
+		"0c0d0e0f101112131415161718191a1b1c1d1e", "a28c6865939a9a79faaa5c4c2a9d4a91cdac8c", "96c861b9c9e61ef1"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000009080706a0a1a2a3a4a5", "0001020304050607",
+		"08090a0b0c0d0e0f101112131415161718191a1b1c1d1e", "0135d1b2c95f41d5d1d4fec185d166b8094e999dfed96c", "048c56602c97acbb7490"},
+	{"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "0000000e0d0c0ba0a1a2a3a4a5", "000102030405060708090a0b",
+		"0c0d0e0f101112131415161718191a1b1c1d1e1f20", "c0ffa0d6f05bdb67f24d43a4338d2aa4bed7b20e43", "cd1aa31662e7ad65d6db"},
+	{"d7828d13b2b0bdc325a76236df93cc6b", "00412b4ea9cdbe3c9696766cfa", "0be1a88bace018b1",
+		"08e8cf97d820ea258460e96ad9cf5289054d895ceac47c", "4cb97f86a2a4689a877947ab8091ef5386a6ffbdd080f8", "e78cf7cb0cddd7b3"},
+	{"d7828d13b2b0bdc325a76236df93cc6b", "0027ca0c7120bc3c9696766cfa", "44a3aa3aae6475ca",
+		"a434a8e58500c6e41530538862d686ea9e81301b5ae4226bfa", "f2beed7bc5098e83feb5b31608f8e29c38819a89c8e776f154", "4d4151a4ed3a8b87b9ce"},
+};
+
+long selftestCCM(){
+	long failed = 0;
+	int count = (int) (sizeof(ccm_vectors)/sizeof(ccm_vectors[0]));
+	for(int v = 0; v <= count; ++v){
+		unsigned char key[16], nonce[16], pt[SELFTEST_MAX], out[SELFTEST_MAX], back[SELFTEST_MAX], tag[16];
+		unsigned char* ad = new unsigned char[65536];
+		unsigned char expanded_key[176];
+		long ad_len, len;
+		int nonce_len, tag_len;
+		const char* ct_hex;
+		const char* tag_hex;
+		if(v < count){
+			const AEADVector* t = ccm_vectors + v;
+			selftestHex(t->key, key);
+			nonce_len = (int) selftestHex(t->nonce, nonce);
+			ad_len = selftestHex(t->ad, ad);
+			len = selftestHex(t->pt, pt);
+			tag_len = (int) strlen(t->tag)/2;
+			ct_hex = t->ct;
+			tag_hex = t->tag;
+		}
+		else{
+			//SP 800-38C example 4: 2^16 bytes of associated data, which takes the six byte length encoding
+			selftestHex("404142434445464748494a4b4c4d4e4f", key);
+			nonce_len = (int) selftestHex("101112131415161718191a1b1c", nonce);
+			for(long i = 0; i < 65536; ++i){
+				ad[i] = (unsigned char) i;
+			}
+			ad_len = 65536;
+			len = selftestHex("202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f", pt);
+			tag_len = 14;
+			ct_hex = "69915dad1e84c6376a68c2967e4dab615ae0fd1faec44cc484828529463ccf72";
+			tag_hex = "b4ac6bec93e8598e7f0dadbcea5b";
+		}
+		expandKey(key, 16, expanded_key, 176);
+		selftestCheck("ccm", v, "encryption refused", ccmEncrypt(expanded_key, nonce, nonce_len, ad, ad_len, pt, out, len, tag, tag_len), &failed);
+		selftestExpect("ccm", v, "ciphertext", out, len, ct_hex, &failed);
+		selftestExpect("ccm", v, "tag", tag, tag_len, tag_hex, &failed);
+		selftestCheck("ccm", v, "valid tag rejected", ccmDecrypt(expanded_key, nonce, nonce_len, ad, ad_len, out, back, len, tag, tag_len), &failed);
+		selftestCheck("ccm", v, "wrong plaintext", memcmp(back, pt, len) == 0, &failed);
+		tag[0] ^= 1;
+		selftestCheck("ccm", v, "tampered tag accepted",
+			!ccmDecrypt(expanded_key, nonce, nonce_len, ad, ad_len, out, back, len, tag, tag_len) && selftestZeroed(back, len), &failed);
+		delete[] ad;
+	}
+	return failed;
+}
+
+/* RFC 4493 section 4: one key, prefixes of one message */
+static const char* cmac_message = "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	"30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+static const long cmac_lengths[] = {0, 16, 40, 64};
+static const char* cmac_tags[] = {"bb1d6929e95937287fa37d129b756746", "070a16b46b4d4144f79bdd9dd04a287c",
+	"dfa66747de9ae63030ca32611497c827", "51f0bebf7e3b9d92fc49741779363cfe"};
+
+long selftestCMAC(){
+	long failed = 0;
+	unsigned char key[16], msg[64], expanded_key[176], tag[16];
+	selftestHex("2b7e151628aed2a6abf7158809cf4f3c", key);
+	selftestHex(cmac_message, msg);
+	expandKey(key, 16, expanded_key, 176);
+	CMACKey cmac;
+	cmacInit(&cmac, expanded_key);
+	for(int v = 0; v < 4; ++v){
+		cmacMessage(&cmac, msg, cmac_lengths[v], tag);
+		selftestExpect("cmac", v, "tag", tag, 16, cmac_tags[v], &failed);
+	}
+	//all four lengths three times over in one batch, more messages than lanes so chains retire and refill
+	const unsigned char* msgs[12];
+	long lens[12];
+	unsigned char tag_mem[16*12];
+	unsigned char* tags[12];
+	for(int m = 0; m < 12; ++m){
+		msgs[m] = msg;
+		lens[m] = cmac_lengths[(m*3) % 4];
+		tags[m] = tag_mem + 16*m;
+	}
+	cmacMany(&cmac, msgs, lens, 12, tags);
+	for(int m = 0; m < 12; ++m){
+		selftestExpect("cmac batch", m, "tag", tags[m], 16, cmac_tags[(m*3) % 4], &failed);
+	}
+	return failed;
+}
+
+/* RFC 8452 appendix C.1 */
+static const AEADVector gcm_siv_vectors[] = {
+	{"01000000000000000000000000000000", "030000000000000000000000", "", "", "", "dc20e2d83f25705bb49e439eca56de25"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "", "0100000000000000", "b5d839330ac7b786",
+		"578782fff6013b815b287c22493a364c"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "", "010000000000000000000000",
+		"7323ea61d05932260047d942", "a4978db357391a0bc4fdec8b0d106639"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "", "01000000000000000000000000000000",
+		"743f7c8077ab25f8624e2e948579cf77", "303aaf90f6fe21199c6068577437a0c4"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "",
+		"0100000000000000000000000000000002000000000000000000000000000000",
+		"84e07e62ba83a6585417245d7ec413a9fe427d6315c09b57ce45f2e3936a9445", "1a8e45dcd4578c667cd86847bf6155ff"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "01", "0200000000000000", "1e6daba35669f427",
+		"3b0a1a2560969cdf790d99759abd1508"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "01", "020000000000000000000000",
+		"296c7889fd99f41917f44620", "08299c5102745aaa3a0c469fad9e075a"},
+	{"01000000000000000000000000000000", "030000000000000000000000", "01",
+		"020000000000000000000000000000000300000000000000000000000000000004000000000000000000000000000000",
+		"50c8303ea93925d64090d07bd109dfd9515a5a33431019c17d93465999a8b0053201d723120a8562b838cdff25bf9d1e",
+		"6a8cc3865f76897c2e4b245cf31c51f2"},
+	{"ee8e1ed9ff2540ae8f2ba9f50bc2f27c", "752abad3e0afb5f434dc4310", "6578616d706c65", "48656c6c6f20776f726c64",
+		"5d349ead175ef6b1def6fd", "4fbcdeb7e4793f4a1d7e4faa70100af1"},
+};
+
+/* The byte fields of one AEAD vector, decoded */
+struct AEADBuffers {
+	unsigned char key[16];
+	unsigned char nonce[16];
+	unsigned char ad[SELFTEST_MAX];
+	unsigned char pt[SELFTEST_MAX];
+	unsigned char out[SELFTEST_MAX];
+	unsigned char back[SELFTEST_MAX];
+	unsigned char tag[16];
+	long ad_len;
+	long len;
+};
+
+void selftestAEADBuffers(const AEADVector* t, AEADBuffers* b){
+	selftestHex(t->key, b->key);
+	selftestHex(t->nonce, b->nonce);
+	b->ad_len = selftestHex(t->ad, b->ad);
+	b->len = selftestHex(t->pt, b->pt);
+}
+
+long selftestGCMSIV(){
+	long failed = 0;
+	int count = (int) (sizeof(gcm_siv_vectors)/sizeof(gcm_siv_vectors[0]));
+	AEADBuffers* b = new AEADBuffers[count];
+	GCMSIVRecord records[sizeof(gcm_siv_vectors)/sizeof(gcm_siv_vectors[0])];
+	unsigned char expanded_key[176];
+	for(int v = 0; v < count; ++v){
+		selftestAEADBuffers(gcm_siv_vectors + v, b + v);
+		GCMSIVRecord* r = records + v;
+		r->nonce = b[v].nonce;
+		r->ad = b[v].ad;
+		r->ad_len = b[v].ad_len;
+		r->in = b[v].pt;
+		r->out = b[v].out;
+		r->len = b[v].len;
+		r->tag = b[v].tag;
+		expandKey(b[v].key, 16, expanded_key, 176);
+		gcmSivSealMany(expanded_key, r, 1);
+		selftestExpect("gcm-siv", v, "ciphertext", r->out, r->len, gcm_siv_vectors[v].ct, &failed);
+		selftestExpect("gcm-siv", v, "tag", r->tag, 16, gcm_siv_vectors[v].tag, &failed);
+		r->in = b[v].out;
+		r->out = b[v].back;
+		selftestCheck("gcm-siv", v, "valid tag rejected", gcmSivOpenMany(expanded_key, r, 1) && memcmp(r->out, b[v].pt, r->len) == 0, &failed);
+	}
+	//the vectors under the first key in one batch each way, with one tag tampered on the way back
+	int batch = 0;
+	while(batch < count && strcmp(gcm_siv_vectors[batch].key, gcm_siv_vectors[0].key) == 0){
+		batch++;
+	}
+	expandKey(b[0].key, 16, expanded_key, 176);
+	for(int v = 0; v < batch; ++v){
+		records[v].in = b[v].pt;
+		records[v].out = b[v].out;
+		memset(b[v].out, 0, b[v].len);
+	}
+	gcmSivSealMany(expanded_key, records, batch);
+	for(int v = 0; v < batch; ++v){
+		selftestExpect("gcm-siv batch", v, "ciphertext", b[v].out, b[v].len, gcm_siv_vectors[v].ct, &failed);
+		selftestExpect("gcm-siv batch", v, "tag", b[v].tag, 16, gcm_siv_vectors[v].tag, &failed);
+		records[v].in = b[v].out;
+		records[v].out = b[v].back;
+	}
+	int bad = batch/2;
+	b[bad].tag[0] ^= 1;
+	selftestCheck("gcm-siv batch", bad, "tampered tag accepted", !gcmSivOpenMany(expanded_key, records, batch), &failed);
+	for(int v = 0; v < batch; ++v){
+		if(v == bad){
+			selftestCheck("gcm-siv batch", v, "tampered tag accepted", !records[v].ok && selftestZeroed(b[v].back, b[v].len), &failed);
+		}
+		else{
+			selftestCheck("gcm-siv batch", v, "valid tag rejected", records[v].ok && memcmp(b[v].back, b[v].pt, b[v].len) == 0, &failed);
+		}
+	}
+	delete[] b;
+	return failed;
+}
+
+/* RFC 7253 appendix A */
+static const AEADVector ocb_vectors[] = {
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221100", "", "", "", "785407bfffc8ad9edcc5520ac9111ee6"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221101", "0001020304050607", "0001020304050607",
+		"6820b3657b6f615a", "5725bda0d3b4eb3a257c9af1f8f03009"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221102", "0001020304050607", "",
+		"", "81017f8203f081277152fade694a0a00"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221103", "", "0001020304050607",
+		"45dd69f8f5aae724", "14054cd1f35d82760b2cd00d2f99bfa9"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221104",
+		"000102030405060708090a0b0c0d0e0f",
+		"000102030405060708090a0b0c0d0e0f",
+		"571d535b60b277188be5147170a9a22c",
+		"3ad7a4ff3835b8c5701c1ccec8fc3358"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221105", "000102030405060708090a0b0c0d0e0f", "",
+		"", "8cf761b6902ef764462ad86498ca6b97"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221106", "", "000102030405060708090a0b0c0d0e0f",
+		"5ce88ec2e0692706a915c00aeb8b2396", "f40e1c743f52436bdf06d8fa1eca343d"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221107",
+		"000102030405060708090a0b0c0d0e0f1011121314151617",
+		"000102030405060708090a0b0c0d0e0f1011121314151617",
+		"1ca2207308c87c010756104d8840ce1952f09673a448a122",
+		"c92c62241051f57356d7f3c90bb0e07f"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221108",
+		"000102030405060708090a0b0c0d0e0f1011121314151617",
+		"",
+		"",
+		"6dc225a071fc1b9f7c69f93b0f1e10de"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa99887766554433221109",
+		"",
+		"000102030405060708090a0b0c0d0e0f1011121314151617",
+		"221bd0de7fa6fe993eccd769460a0af2d6cded0c395b1c3c",
+		"e725f32494b9f914d85c0b1eb38357ff"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110a",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"bd6f6c496201c69296c11efd138a467abd3c707924b964deaffc40319af5a485",
+		"40fbba186c5553c68ad9f592a79a4240"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110b",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"",
+		"",
+		"fe80690bee8a485d11f32965bc9d2a32"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110c",
+		"",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"2942bfc773bda23cabc6acfd9bfd5835bd300f0973792ef46040c53f1432bcdf",
+		"b5e1dde3bc18a5f840b52e653444d5df"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110d",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"d5ca91748410c1751ff8a2f618255b68a0a12e093ff454606e59f9c1d0ddc54b65e8628e568bad7a",
+		"ed07ba06a4a69483a7035490c5769e60"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110e",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"",
+		"",
+		"c5cd9d1850c141e358649994ee701b68"},
+	{"000102030405060708090a0b0c0d0e0f", "bbaa9988776655443322110f",
+		"",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"4412923493c57d5de0d700f753cce0d1d2d95060122e9f15a5ddbfc5787e50b5cc55ee507bcb084e",
+		"479ad363ac366b95a98ca5f3000b1479"},
+	{"0f0e0d0c0b0a09080706050403020100", "bbaa9988776655443322110d",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f2021222324252627",
+		"1792a4e31e0755fb03e31b22116e6c2ddf9efd6e33d536f1a0124b0a55bae884ed93481529c76b6a",
+		"d0c515f4d1cdd4fdac4f02aa"},
+};
+
+/* The iterated test of RFC 7253 appendix A: 384 encryptions of every length up to 127 bytes, all of whose output
+   is authenticated by one more. tag_len is 16, 12 or 8 */
+void selftestOCBIterated(int tag_len, unsigned char* result){
+	unsigned char key[16] = {0};
+	unsigned char expanded_key[176];
+	unsigned char nonce[12] = {0};
+	unsigned char zeros[128] = {0};
+	unsigned char* c = new unsigned char[128*(2*128 + 3*16)];
+	long c_len = 0;
+	OCBKey ocb;
+	key[15] = (unsigned char) (8*tag_len);
+	expandKey(key, 16, expanded_key, 176);
+	ocbInit(&ocb, expanded_key);
+	for(int i = 0; i < 128; ++i){
+		nonce[10] = (unsigned char) ((3*i + 1) >> 8);
+		nonce[11] = (unsigned char) (3*i + 1);
+		ocbEncrypt(&ocb, nonce, 12, zeros, i, zeros, c + c_len, i, c + c_len + i, tag_len);
+		c_len += i + tag_len;
+		nonce[10] = (unsigned char) ((3*i + 2) >> 8);
+		nonce[11] = (unsigned char) (3*i + 2);
+		ocbEncrypt(&ocb, nonce, 12, NULL, 0, zeros, c + c_len, i, c + c_len + i, tag_len);
+		c_len += i + tag_len;
+		nonce[10] = (unsigned char) ((3*i + 3) >> 8);
+		nonce[11] = (unsigned char) (3*i + 3);
+		ocbEncrypt(&ocb, nonce, 12, zeros, i, NULL, NULL, 0, c + c_len, tag_len);
+		c_len += tag_len;
+	}
+	nonce[10] = 385 >> 8;
+	nonce[11] = 385 & 0xff;
+	ocbEncrypt(&ocb, nonce, 12, c, c_len, NULL, NULL, 0, result, tag_len);
+	delete[] c;
+}
+
+long selftestOCB(){
+	long failed = 0;
+	int count = (int) (sizeof(ocb_vectors)/sizeof(ocb_vectors[0]));
+	AEADBuffers* b = new AEADBuffers;
+	unsigned char expanded_key[176];
+	OCBKey ocb;
+	for(int v = 0; v < count; ++v){
+		const AEADVector* t = ocb_vectors + v;
+		int tag_len = (int) strlen(t->tag)/2;
+		selftestAEADBuffers(t, b);
+		expandKey(b->key, 16, expanded_key, 176);
+		ocbInit(&ocb, expanded_key);
+		selftestCheck("ocb", v, "encryption refused", ocbEncrypt(&ocb, b->nonce, 12, b->ad, b->ad_len, b->pt, b->out, b->len, b->tag, tag_len), &failed);
+		selftestExpect("ocb", v, "ciphertext", b->out, b->len, t->ct, &failed);
+		selftestExpect("ocb", v, "tag", b->tag, tag_len, t->tag, &failed);
+		selftestCheck("ocb", v, "valid tag rejected", ocbDecrypt(&ocb, b->nonce, 12, b->ad, b->ad_len, b->out, b->back, b->len, b->tag, tag_len)
+			&& memcmp(b->back, b->pt, b->len) == 0, &failed);
+		b->tag[tag_len - 1] ^= 0x80;
+		selftestCheck("ocb", v, "tampered tag accepted", !ocbDecrypt(&ocb, b->nonce, 12, b->ad, b->ad_len, b->out, b->back, b->len, b->tag, tag_len)
+			&& selftestZeroed(b->back, b->len), &failed);
+	}
+	const char* iterated[] = {"67e944d23256c5e0b6c61fa22fdf1ea2", "77a3d8e73589158d25d01209", "192c9b7bd90ba06a"};
+	for(int k = 0; k < 3; ++k){
+		unsigned char result[16];
+		selftestOCBIterated(16 - 4*k, result);
+		selftestExpect("ocb iterated", k, "result", result, 16 - 4*k, iterated[k], &failed);
+	}
+	delete b;
+	return failed;
+}
+
+/* A known answer for key wrap */
+struct KeyWrapVector {
+	const char* pt;
+	const char* ct;
+	int padded;
+};
+
+/* RFC 3394 section 4.1 under its AES-128 KEK. RFC 5649 only publishes answers under a 192 bit KEK, so the KWP
+   entries wrap its two plaintexts and some lengths around one block under the same KEK as the first vector,
+   with answers that OpenSSL and PyCryptodome agree on */
+static const char* kw_kek = "000102030405060708090a0b0c0d0e0f";
+static const KeyWrapVector kw_vectors[] = {
+	{"00112233445566778899aabbccddeeff", "1fa68b0a8112b447aef34bd8fb5a7b829d3e862371d2cfe5", 0},
+	{"00112233445566778899aabbccddeeff0001020304050607",
+		"889671106535a9f86d9f9a262f674569efa38d7535aac77527cab92855bddd6e", 0},
+	{"00112233445566778899aabbccddeeff000102030405060708090a0b0c0d0e0f",
+		"11826840774d993ff9c2fa02cca3cea0e93b1e1cf96361f93ea6dc2f345194e7b30f964c79f9e61d", 0},
+	{"c37b7e6492584340bed12207808941155068f738", "e1f7176ecbd75d42e82b24f989a2816c209c6ef2d1aa94d2a3e60284900d03a2", 1},
+	{"466f7250617369", "be80535e12e9394c8f8df26bd9528a35", 1},
+	{"ff", "014c40458aea78910fd4914e17b99a73", 1},
+	{"0011223344556677", "23ea99084e592c2f29f496536c00d5af", 1},
+	{"001122334455667788", "b4bd457489f2aabdbebf0db46e64e195af069b81a9f3d20d", 1},
+};
+
+long selftestKeyWrap(){
+	long failed = 0;
+	const int count = (int) (sizeof(kw_vectors)/sizeof(kw_vectors[0]));
+	unsigned char key[16], expanded_key[176];
+	unsigned char pt[count][64], ct[count][64], out[count][64], back[count][64];
+	long pt_len[count], ct_len[count];
+	KeyWrapJob jobs[count];
+	selftestHex(kw_kek, key);
+	expandKey(key, 16, expanded_key, 176);
+	for(int v = 0; v < count; ++v){
+		pt_len[v] = selftestHex(kw_vectors[v].pt, pt[v]);
+		ct_len[v] = selftestHex(kw_vectors[v].ct, ct[v]);
+		KeyWrapJob job = {pt[v], pt_len[v], out[v], 0, kw_vectors[v].padded, 0};
+		keyWrapMany(expanded_key, &job, 1);
+		selftestCheck("kw", v, "wrap refused", job.ok, &failed);
+		selftestExpect("kw", v, "wrapped key", out[v], job.out_len, kw_vectors[v].ct, &failed);
+		KeyWrapJob unwrap = {ct[v], ct_len[v], back[v], 0, kw_vectors[v].padded, 0};
+		keyUnwrapMany(expanded_key, &unwrap, 1);
+		selftestCheck("kw", v, "valid key rejected", unwrap.ok && unwrap.out_len == pt_len[v] && memcmp(back[v], pt[v], pt_len[v]) == 0, &failed);
+	}
+	//every vector in one batch each way, KW and KWP mixed, with one wrapped key corrupted on the way back
+	for(int v = 0; v < count; ++v){
+		jobs[v].in = pt[v];
+		jobs[v].in_len = pt_len[v];
+		jobs[v].out = out[v];
+		jobs[v].padded = kw_vectors[v].padded;
+		memset(out[v], 0, sizeof(out[v]));
+	}
+	keyWrapMany(expanded_key, jobs, count);
+	for(int v = 0; v < count; ++v){
+		selftestCheck("kw batch", v, "wrap refused", jobs[v].ok, &failed);
+		selftestExpect("kw batch", v, "wrapped key", out[v], jobs[v].out_len, kw_vectors[v].ct, &failed);
+		jobs[v].in = ct[v];
+		jobs[v].in_len = ct_len[v];
+		jobs[v].out = back[v];
+		memset(back[v], 0, sizeof(back[v]));
+	}
+	int bad = count/2;
+	ct[bad][ct_len[bad] - 1] ^= 1;
+	keyUnwrapMany(expanded_key, jobs, count);
+	for(int v = 0; v < count; ++v){
+		if(v == bad){
+			selftestCheck("kw batch", v, "corrupted key accepted", !jobs[v].ok && selftestZeroed(back[v], ct_len[v] - 8), &failed);
+		}
+		else{
+			selftestCheck("kw batch", v, "valid key rejected", jobs[v].ok && jobs[v].out_len == pt_len[v]
+				&& memcmp(back[v], pt[v], pt_len[v]) == 0, &failed);
+		}
+	}
+	return failed;
+}
+
+/* A known answer for FF1 or FF3-1, numerals written with the digits and lowercase letters */
+struct FPEVector {
+	int ff3;
+	const char* key;
+	int radix;
+	const char* tweak;
+	const char* pt;
+	const char* ct;
+};
+
+/* SP 800-38G samples 1 to 3 for FF1, and FF3-1 answers under the 56 bit tweaks of Rev. 1. The last FF1 entry
+   takes the longest tweak accepted (FPE_MAX_TWEAK bytes counting up from 0, filled in by selftestFPE) with the
+   longest string, which gives the largest Q */
+static const char* fpe_digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+static const FPEVector fpe_vectors[] = {
+	{0, "2b7e151628aed2a6abf7158809cf4f3c", 10, "", "0123456789", "2433477484"},
+	{0, "2b7e151628aed2a6abf7158809cf4f3c", 10, "39383736353433323130", "0123456789", "6124200773"},
+	{0, "2b7e151628aed2a6abf7158809cf4f3c", 36, "3737373770717273373737", "0123456789abcdefghi", "a9tv40mll9kdu509eum"},
+	{0, "2b7e151628aed2a6abf7158809cf4f3c", 10, NULL, "01234567890123456789012345678901234567",
+		"23267999777969968926778652489151582031"},
+	{1, "ef4359d8d580aa4f7f036d6f04fc6a94", 10, "d8e7920afa330a", "890121234567890000", "477064185124354662"},
+	{1, "2de79d232df5585d68ce47882ae256d6", 10, "cbd09280979564", "3992520240", "8901801106"},
+};
+
+/* The numerals of a string, returns how many */
+int selftestNumerals(const char* s, unsigned int* x){
+	int n = 0;
+	for(; *s != 0; ++s){
+		x[n++] = (unsigned int) (strchr(fpe_digits, *s) - fpe_digits);
+	}
+	return n;
+}
+
+/* Compare numerals with their expected string, counting and reporting a mismatch */
+void selftestExpectNumerals(const char* mode, int vector, const unsigned int* got, int n, const char* expected, long* failed){
+	int same = (int) strlen(expected) == n;
+	for(int i = 0; same && i < n; ++i){
+		same = got[i] < 36 && fpe_digits[got[i]] == expected[i];
+	}
+	selftestCheck(mode, vector, "wrong numerals", same, failed);
+}
+
+long selftestFPE(){
+	long failed = 0;
+	const int count = (int) (sizeof(fpe_vectors)/sizeof(fpe_vectors[0]));
+	unsigned char key[16], long_tweak[FPE_MAX_TWEAK + 1];
+	unsigned char tweak[count][FPE_MAX_TWEAK];
+	unsigned int pt[count][64], out[count][64], back[count][64];
+	FPEToken tokens[count];
+	FPEKey fpe;
+	for(int b = 0; b <= FPE_MAX_TWEAK; ++b){
+		long_tweak[b] = (unsigned char) b;
+	}
+	for(int v = 0; v < count; ++v){
+		const FPEVector* t = fpe_vectors + v;
+		const char* mode = t->ff3 ? "ff3-1" : "ff1";
+		FPEToken* token = tokens + v;
+		selftestHex(t->key, key);
+		fpeInit(&fpe, key);
+		token->n = selftestNumerals(t->pt, pt[v]);
+		if(t->tweak != NULL){
+			token->tweak_len = (int) selftestHex(t->tweak, tweak[v]);
+		}
+		else{
+			memcpy(tweak[v], long_tweak, FPE_MAX_TWEAK);
+			token->tweak_len = FPE_MAX_TWEAK;
+		}
+		token->tweak = tweak[v];
+		token->in = pt[v];
+		token->out = out[v];
+		(t->ff3 ? ff3EncryptMany : ff1EncryptMany)(&fpe, t->radix, token, 1);
+		selftestCheck(mode, v, "encryption refused", token->ok, &failed);
+		selftestExpectNumerals(mode, v, out[v], token->n, t->ct, &failed);
+		token->in = out[v];
+		token->out = back[v];
+		(t->ff3 ? ff3DecryptMany : ff1DecryptMany)(&fpe, t->radix, token, 1);
+		selftestCheck(mode, v, "decryption refused", token->ok, &failed);
+		selftestExpectNumerals(mode, v, back[v], token->n, t->pt, &failed);
+	}
+	//the decimal FF1 vectors in one batch, mixed lengths and tweaks, alongside a token whose tweak is one byte too
+	//long: that one must be refused without disturbing the others
+	selftestHex(fpe_vectors[0].key, key);
+	fpeInit(&fpe, key);
+	unsigned int long_out[64];
+	FPEToken batch[count + 1];
+	int batch_vector[count + 1];
+	int used = 0;
+	for(int v = 0; v < count; ++v){
+		if(!fpe_vectors[v].ff3 && fpe_vectors[v].radix == 10){
+			batch_vector[used] = v;
+			batch[used] = tokens[v];
+			batch[used].in = pt[v];
+			batch[used].out = out[v];
+			memset(out[v], 0, sizeof(out[v]));
+			used++;
+		}
+		if(used == 1){
+			FPEToken too_long = {pt[0], long_out, tokens[0].n, long_tweak, FPE_MAX_TWEAK + 1, 1};
+			batch_vector[used] = -1;
+			batch[used++] = too_long;
+		}
+	}
+	ff1EncryptMany(&fpe, 10, batch, used);
+	for(int i = 0; i < used; ++i){
+		int v = batch_vector[i];
+		if(v < 0){
+			selftestCheck("ff1 batch", i, "over long tweak accepted", !batch[i].ok, &failed);
+		}
+		else{
+			selftestCheck("ff1 batch", v, "encryption refused", batch[i].ok, &failed);
+			selftestExpectNumerals("ff1 batch", v, out[v], batch[i].n, fpe_vectors[v].ct, &failed);
+		}
+	}
+	return failed;
+}
+
+/* A known answer for AES-SIV, with up to three associated data components (a nonce is just the last one) */
+struct SIVVector {
+	const char* key;
+	int ad_count;
+	const char* ad[3];
+	const char* pt;
+	const char* v;
+	const char* ct;
+};
+
+/* RFC 5297 appendix A.1 (deterministic) and A.2 (nonce based), then more records under the A.1 key with answers
+   from PyCryptodome: no associated data, the A.2 components with a block of plaintext, an empty component, and
+   the A.2 plaintext */
+static const SIVVector siv_vectors[] = {
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 1,
+		{"101112131415161718191a1b1c1d1e1f2021222324252627"},
+		"112233445566778899aabbccddee", "85632d07c6e8f37f950acd320a2ecc93", "40c02b9690c4dc04daef7f6afe5c"},
+	{"7f7e7d7c7b7a79787776757473727170404142434445464748494a4b4c4d4e4f", 3,
+		{"00112233445566778899aabbccddeeffdeaddadadeaddadaffeeddccbbaa99887766554433221100", "102030405060708090a0",
+			"09f911029d74e35bd84156c5635688c0"},
+		"7468697320697320736f6d6520706c61696e7465787420746f20656e6372797074207573696e67205349562d414553",
+		"7bdb6e3b432667eb06f4d14bff2fbd0f",
+		"cb900f2fddbe404326601965c889bf17dba77ceb094fa663b7a3f748ba8af829ea64ad544a272e9c485b62a3fd5c0d"},
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 0, {NULL}, "", "f2007a5beb2b8900c588a7adf599f172", ""},
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 3,
+		{"00112233445566778899aabbccddeeffdeaddadadeaddadaffeeddccbbaa99887766554433221100", "102030405060708090a0",
+			"09f911029d74e35bd84156c5635688c0"},
+		"000102030405060708090a0b0c0d0e0f", "870610ebfd6f21227785d73b995a7084", "c688eadb7793f5c9b44d4d8ddb277332"},
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 1, {""},
+		"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20", "bec9e3adc85c8565dd84f600dc93f6b2",
+		"5df8a02b3e78bb7d5d4055be9802d36135a99726283d6ea7c6010d92f4306dfc20"},
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 1,
+		{"101112131415161718191a1b1c1d1e1f2021222324252627"},
+		"7468697320697320736f6d6520706c61696e7465787420746f20656e6372797074207573696e67205349562d414553",
+		"aa17b703a003ef1d4438cdeaf7973191",
+		"b57e1dd8f8a5e8197aab01e970b9744b94500897582052577b6d8b5e0053d136c13169eb611e298c896c68507a6157"},
+};
+
+/* The decoded fields of one SIV vector */
+struct SIVBuffers {
+	unsigned char key[32];
+	unsigned char ad_mem[3][SELFTEST_MAX];
+	const unsigned char* ad[3];
+	long ad_lens[3];
+	unsigned char pt[SELFTEST_MAX];
+	unsigned char out[SELFTEST_MAX];
+	unsigned char back[SELFTEST_MAX];
+	unsigned char v[16];
+};
+
+long selftestSIV(){
+	long failed = 0;
+	const int count = (int) (sizeof(siv_vectors)/sizeof(siv_vectors[0]));
+	SIVBuffers* b = new SIVBuffers[count];
+	SIVRecord records[count];
+	SIVKey siv;
+	for(int v = 0; v < count; ++v){
+		const SIVVector* t = siv_vectors + v;
+		SIVRecord* r = records + v;
+		selftestHex(t->key, b[v].key);
+		for(int c = 0; c < t->ad_count; ++c){
+			b[v].ad_lens[c] = selftestHex(t->ad[c], b[v].ad_mem[c]);
+			b[v].ad[c] = b[v].ad_mem[c];
+		}
+		r->ad = b[v].ad;
+		r->ad_lens = b[v].ad_lens;
+		r->ad_count = t->ad_count;
+		r->in = b[v].pt;
+		r->out = b[v].out;
+		r->len = selftestHex(t->pt, b[v].pt);
+		r->v = b[v].v;
+		sivInit(&siv, b[v].key);
+		sivSealMany(&siv, r, 1);
+		selftestExpect("siv", v, "ciphertext", r->out, r->len, t->ct, &failed);
+		selftestExpect("siv", v, "synthetic iv", r->v, 16, t->v, &failed);
+		r->in = b[v].out;
+		r->out = b[v].back;
+		selftestCheck("siv", v, "valid iv rejected", sivOpenMany(&siv, r, 1) && memcmp(r->out, b[v].pt, r->len) == 0, &failed);
+	}
+	//the vectors under the first key in one batch each way, with one synthetic IV tampered on the way back
+	int batch[count];
+	int used = 0;
+	for(int v = 0; v < count; ++v){
+		if(strcmp(siv_vectors[v].key, siv_vectors[0].key) == 0){
+			batch[used++] = v;
+		}
+	}
+	SIVRecord batch_records[count];
+	for(int i = 0; i < used; ++i){
+		int v = batch[i];
+		batch_records[i] = records[v];
+		batch_records[i].in = b[v].pt;
+		batch_records[i].out = b[v].out;
+		memset(b[v].out, 0, sizeof(b[v].out));
+	}
+	sivInit(&siv, b[0].key);
+	sivSealMany(&siv, batch_records, used);
+	for(int i = 0; i < used; ++i){
+		int v = batch[i];
+		selftestExpect("siv batch", v, "ciphertext", b[v].out, batch_records[i].len, siv_vectors[v].ct, &failed);
+		selftestExpect("siv batch", v, "synthetic iv", b[v].v, 16, siv_vectors[v].v, &failed);
+		batch_records[i].in = b[v].out;
+		batch_records[i].out = b[v].back;
+	}
+	int bad = used/2;
+	b[batch[bad]].v[0] ^= 1;
+	selftestCheck("siv batch", batch[bad], "tampered iv accepted", !sivOpenMany(&siv, batch_records, used), &failed);
+	for(int i = 0; i < used; ++i){
+		int v = batch[i];
+		if(i == bad){
+			selftestCheck("siv batch", v, "tampered iv accepted", !batch_records[i].ok && selftestZeroed(b[v].back, batch_records[i].len), &failed);
+		}
+		else{
+			selftestCheck("siv batch", v, "valid iv rejected", batch_records[i].ok && memcmp(b[v].back, b[v].pt, batch_records[i].len) == 0, &failed);
+		}
+	}
+	delete[] b;
+	return failed;
+}
+
+/* McGrew and Viega, "The Galois/Counter Mode of Operation", test cases 1 to 4 (the 96 bit IV ones under AES-128) */
+static const AEADVector gcm_vectors[] = {
+	{"00000000000000000000000000000000", "000000000000000000000000", "", "", "", "58e2fccefa7e3061367f1d57a4e7455a"},
+	{"00000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+		"0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf"},
+	{"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+		"42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+		"4d5c2af327cd64a62cf35abd2ba6fab4"},
+	{"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+		"42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+		"5bc94fbc3221a5db94fae95ae7121a47"},
+};
+
+long selftestGCM(){
+	long failed = 0;
+	int count = (int) (sizeof(gcm_vectors)/sizeof(gcm_vectors[0]));
+	AEADBuffers* b = new AEADBuffers;
+	unsigned char expanded_key[176];
+	GCMKey gcm;
+	for(int v = 0; v <= count; ++v){
+		const char* ct_hex = NULL;
+		const char* tag_hex;
+		if(v < count){
+			selftestAEADBuffers(gcm_vectors + v, b);
+			ct_hex = gcm_vectors[v].ct;
+			tag_hex = gcm_vectors[v].tag;
+		}
+		else{
+			//several GCM_SLICE slices and a partial block, under the test case 3 key, checked through the tag
+			selftestHex(gcm_vectors[2].key, b->key);
+			selftestHex(gcm_vectors[2].nonce, b->nonce);
+			b->ad_len = 37;
+			b->len = 3000;
+			for(long i = 0; i < b->ad_len; ++i){
+				b->ad[i] = (unsigned char) i;
+			}
+			for(long i = 0; i < b->len; ++i){
+				b->pt[i] = (unsigned char) (7*i + 1);
+			}
+			tag_hex = "a8b9865adfc5a9837baebd04597e9cde";
+		}
+		expandKey(b->key, 16, expanded_key, 176);
+		gcmInit(&gcm, expanded_key);
+		gcmSeal(&gcm, b->nonce, b->ad, b->ad_len, b->pt, b->out, b->len, b->tag);
+		if(ct_hex != NULL){
+			selftestExpect("gcm", v, "ciphertext", b->out, b->len, ct_hex, &failed);
+		}
+		selftestExpect("gcm", v, "tag", b->tag, 16, tag_hex, &failed);
+		selftestCheck("gcm", v, "valid tag rejected", gcmOpen(&gcm, b->nonce, b->ad, b->ad_len, b->out, b->back, b->len, b->tag)
+			&& memcmp(b->back, b->pt, b->len) == 0, &failed);
+		b->tag[15] ^= 0x80;
+		selftestCheck("gcm", v, "tampered tag accepted", !gcmOpen(&gcm, b->nonce, b->ad, b->ad_len, b->out, b->back, b->len, b->tag)
+			&& selftestZeroed(b->back, b->len), &failed);
+	}
+	delete b;
+	return failed;
+}
+
+/* Open a container held in memory. Returns the containerOpen result and the plaintext in out */
+int selftestContainerOpen(unsigned char* expanded_key, const unsigned char* sealed, long len, unsigned char* out, long* out_len){
+	FILE* in = tmpfile();
+	FILE* plain = tmpfile();
+	int result = 2;
+	if(in != NULL && plain != NULL && fwrite(sealed, 1, len, in) == (size_t) len && fseek(in, 0, SEEK_SET) == 0){
+		result = containerOpen(expanded_key, in, plain, 3);
+		*out_len = ftell(plain);
+		if(fseek(plain, 0, SEEK_SET) != 0 || (long) fread(out, 1, *out_len, plain) != *out_len){
+			result = 2;
+		}
+	}
+	if(in != NULL){
+		fclose(in);
+	}
+	if(plain != NULL){
+		fclose(plain);
+	}
+	return result;
+}
+
+/* --seal then --open, and a container with a flipped byte, a dropped final chunk, two chunks swapped, a cut
+   inside a chunk, a changed header or under another key, none of which may open. Chunks are 100 bytes and groups are 3 chunks */
+long selftestContainer(){
+	long failed = 0;
+	const long chunk = 100, len = 1050;
+	const long stored = chunk + 16;
+	unsigned char key[16], expanded_key[176], other_key[176];
+	unsigned char* pt = new unsigned char[len];
+	unsigned char* sealed = new unsigned char[2*len + 1024];
+	unsigned char* changed = new unsigned char[2*len + 1024];
+	unsigned char* back = new unsigned char[2*len + 1024];
+	long sealed_len = 0, back_len = 0;
+	selftestHex("000102030405060708090a0b0c0d0e0f", key);
+	expandKey(key, 16, expanded_key, 176);
+	key[0] ^= 1;
+	expandKey(key, 16, other_key, 176);
+	for(long i = 0; i < len; ++i){
+		pt[i] = (unsigned char) (i*13);
+	}
+	FILE* in = tmpfile();
+	FILE* out = tmpfile();
+	int sealed_ok = in != NULL && out != NULL && fwrite(pt, 1, len, in) == (size_t) len && fseek(in, 0, SEEK_SET) == 0
+		&& containerSeal(expanded_key, in, out, chunk, 3) == 0;
+	if(sealed_ok){
+		sealed_len = ftell(out);
+		sealed_ok = fseek(out, 0, SEEK_SET) == 0 && (long) fread(sealed, 1, sealed_len, out) == sealed_len;
+	}
+	if(in != NULL){
+		fclose(in);
+	}
+	if(out != NULL){
+		fclose(out);
+	}
+	selftestCheck("container", 0, "seal failed", sealed_ok && sealed_len == CONTAINER_HEADER + len + 16*((len + chunk - 1)/chunk), &failed);
+	if(sealed_ok){
+		selftestCheck("container", 0, "did not open", selftestContainerOpen(expanded_key, sealed, sealed_len, back, &back_len) == 0
+			&& back_len == len && memcmp(back, pt, len) == 0, &failed);
+		for(int t = 1; t <= 7; ++t){
+			long changed_len = sealed_len;
+			unsigned char* key_used = expanded_key;
+			memcpy(changed, sealed, sealed_len);
+			if(t == 1){
+				changed[CONTAINER_HEADER + 4*stored + 7] ^= 1;           //a ciphertext byte
+			}
+			else if(t == 2){
+				changed_len = CONTAINER_HEADER + 10*stored;             //the final chunk dropped
+			}
+			else if(t == 3){
+				memcpy(changed + CONTAINER_HEADER + 4*stored, sealed + CONTAINER_HEADER + 5*stored, stored);
+				memcpy(changed + CONTAINER_HEADER + 5*stored, sealed + CONTAINER_HEADER + 4*stored, stored);
+			}
+			else if(t == 4){
+				changed_len -= 20;                                      //cut inside the final chunk
+			}
+			else if(t == 5){
+				changed[9] ^= 1;                                        //the chunk size
+			}
+			else if(t == 6){
+				changed[12 + CONTAINER_SALT - 1] ^= 1;                  //the salt, so another chunk key
+			}
+			else{
+				key_used = other_key;
+			}
+			selftestCheck("container", t, "damaged container opened",
+				selftestContainerOpen(key_used, changed, changed_len, back, &back_len) == 1, &failed);
+		}
+	}
+	delete[] pt;
+	delete[] sealed;
+	delete[] changed;
+	delete[] back;
+	return failed;
+}
+
+/* NIST SP 800-38A F.5.1 and F.5.2. The low bytes of the counter block wrap while it runs */
+static const char* ctr_pt = "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	"30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+static const char* ctr_ct = "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+	"5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee";
+
+long selftestCTR(){
+	long failed = 0;
+	unsigned char key[16], iv[16], expanded_key[176], pt[64], ct[64], out[64];
+	selftestHex("2b7e151628aed2a6abf7158809cf4f3c", key);
+	selftestHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", iv);
+	selftestHex(ctr_pt, pt);
+	selftestHex(ctr_ct, ct);
+	expandKey(key, 16, expanded_key, 176);
+	ctrCryptAt(expanded_key, iv, 0, pt, out, 64);
+	selftestExpect("ctr", 0, "ciphertext", out, 64, ctr_ct, &failed);
+	ctrCryptAt(expanded_key, iv, 0, ct, out, 64);
+	selftestExpect("ctr", 1, "plaintext", out, 64, ctr_pt, &failed);
+	//every range of the object must equal the same slice of the whole plaintext
+	int ranges_ok = 1;
+	for(long offset = 0; offset <= 64; ++offset){
+		for(long len = 0; offset + len <= 64; ++len){
+			memset(out, 0, sizeof(out));
+			ctrCryptRange(expanded_key, iv, ct, offset, len, out);
+			ranges_ok &= memcmp(out, pt + offset, len) == 0;
+		}
+	}
+	selftestCheck("ctr", 2, "a range differs from the whole decryption", ranges_ok, &failed);
+	return failed;
+}
+
+/* NIST SP 800-38A F.3.13 (CFB128) and F.4.1 (OFB), on the F.5 key and plaintext */
+static const char* cfb_ct = "3b3fd92eb72dad20333449f8e83cfb4ac8a64537a0b3a93fcde3cdad9f1ce58b"
+	"26751f67a3cbb140b1808cf187a4f4dfc04b05357c5d1c0eeac4c66f9ff7f2e6";
+static const char* ofb_ct = "3b3fd92eb72dad20333449f8e83cfb4a7789508d16918f03f53c52dac54ed825"
+	"9740051e9c5fecf64344f7a82260edcc304c6528f659c77866a510d9c1d6ae5e";
+
+long selftestCFB(){
+	long failed = 0;
+	const long long_len = 16*2*LANES + 7; //lane batches, a remainder and a partial block
+	unsigned char key[16], iv[16], expanded_key[176], pt[long_len], ct[long_len], buf[long_len];
+	selftestHex("2b7e151628aed2a6abf7158809cf4f3c", key);
+	selftestHex("000102030405060708090a0b0c0d0e0f", iv);
+	selftestHex(ctr_pt, pt);
+	expandKey(key, 16, expanded_key, 176);
+	CFBState cfb;
+	cfbInit(&cfb, expanded_key, iv);
+	cfbEncrypt(&cfb, pt, buf, 64);
+	selftestExpect("cfb", 0, "ciphertext", buf, 64, cfb_ct, &failed);
+	cfbInit(&cfb, expanded_key, iv);
+	cfbDecrypt(&cfb, buf, buf, 64);
+	selftestExpect("cfb", 1, "plaintext", buf, 64, ctr_pt, &failed);
+	//a longer message split in two at every byte, decrypted in place and encrypted, must match one call
+	for(long i = 0; i < long_len; ++i){
+		pt[i] = (unsigned char) (11*i + 5);
+	}
+	cfbInit(&cfb, expanded_key, iv);
+	cfbEncrypt(&cfb, pt, ct, long_len);
+	int split_ok = 1;
+	for(long split = 0; split <= long_len; ++split){
+		memcpy(buf, ct, long_len);
+		cfbInit(&cfb, expanded_key, iv);
+		cfbDecrypt(&cfb, buf, buf, split);
+		cfbDecrypt(&cfb, buf + split, buf + split, long_len - split);
+		split_ok &= memcmp(buf, pt, long_len) == 0;
+		cfbInit(&cfb, expanded_key, iv);
+		cfbEncrypt(&cfb, pt, buf, split);
+		cfbEncrypt(&cfb, pt + split, buf + split, long_len - split);
+		split_ok &= memcmp(buf, ct, long_len) == 0;
+	}
+	selftestCheck("cfb", 2, "a split call differs from one call", split_ok, &failed);
+	return failed;
+}
+
+long selftestOFB(){
+	long failed = 0;
+	const long long_len = 3*16*OFB_RING_BLOCKS + 100; //round the ring three times
+	unsigned char key[16], iv[16], expanded_key[176], buf[64];
+	selftestHex("2b7e151628aed2a6abf7158809cf4f3c", key);
+	selftestHex("000102030405060708090a0b0c0d0e0f", iv);
+	selftestHex(ctr_pt, buf);
+	expandKey(key, 16, expanded_key, 176);
+	OFBState* ofb = new OFBState;
+	ofbInit(ofb, expanded_key, iv);
+	ofbCrypt(ofb, buf, buf, 64);
+	selftestExpect("ofb", 0, "ciphertext", buf, 64, ofb_ct, &failed);
+	//pieces of uneven sizes in place, with prefetches of uneven sizes between them, against a keystream made
+	//block by block
+	unsigned char* expected = new unsigned char[long_len + 16];
+	unsigned char* data = new unsigned char[long_len];
+	unsigned char block[16];
+	memcpy(block, iv, 16);
+	for(long off = 0; off < long_len; off += 16){
+		encryptBlock(block, block, expanded_key);
+		memcpy(expected + off, block, 16);
+	}
+	memset(data, 0, long_len);
+	ofbInit(ofb, expanded_key, iv);
+	unsigned int step = 1;
+	for(long off = 0; off < long_len; ){
+		step = step*1103515245 + 12345;
+		long n = 1 + (long) (step >> 16) % 700;
+		if(n > long_len - off){
+			n = long_len - off;
+		}
+		ofbPrefetch(ofb, (int) ((step >> 8) % (OFB_RING_BLOCKS + 40)));
+		ofbCrypt(ofb, data + off, data + off, n);
+		off += n;
+	}
+	selftestCheck("ofb", 1, "keystream wrong across the ring", memcmp(data, expected, long_len) == 0, &failed);
+	delete ofb;
+	delete[] expected;
+	delete[] data;
+	return failed;
+}
+
+/* A known answer for XTS-AES-128: data key || tweak key, the data unit number and one data unit */
+struct XTSVector {
+	const char* key;
+	uint64_t unit;
+	const char* pt;   //NULL for 0, 1, ..., 255 twice
+	const char* ct;
+};
+
+/* IEEE 1619 appendix B, vectors 1 to 4 */
+static const XTSVector xts_vectors[] = {
+	{"0000000000000000000000000000000000000000000000000000000000000000", 0,
+		"0000000000000000000000000000000000000000000000000000000000000000",
+		"917cf69ebd68b2ec9b9fe9a3eadda692cd43d2f59598ed858c02c2652fbf922e"},
+	{"1111111111111111111111111111111122222222222222222222222222222222", 0x3333333333ULL,
+		"4444444444444444444444444444444444444444444444444444444444444444",
+		"c454185e6a16936e39334038acef838bfb186fff7480adc4289382ecd6d394f0"},
+	{"fffefdfcfbfaf9f8f7f6f5f4f3f2f1f022222222222222222222222222222222", 0x3333333333ULL,
+		"4444444444444444444444444444444444444444444444444444444444444444",
+		"af85336b597afc1a900b2eb21ec949d292df4c047e0b21532186a5971a227a89"},
+	{"2718281828459045235360287471352631415926535897932384626433832795", 0, NULL,
+		"27a7479befa1d476489f308cd4cfa6e2a96e4bbe3208ff25287dd3819616e89cc78cf7f5e543445f8333d8fa7f56000005279fa5d8b5e4ad40e736ddb4d35412"
+		"328063fd2aab53e5ea1e0a9f332500a5df9487d07a5c92cc512c8866c7e860ce93fdf166a24912b422976146ae20ce846bb7dc9ba94a767aaef20c0d61ad0265"
+		"5ea92dc4c4e41a8952c651d33174be51a10c421110e6d81588ede82103a252d8a750e8768defffed9122810aaeb99f9172af82b604dc4b8e51bcb08235a6f434"
+		"1332e4ca60482a4ba1a03b3e65008fc5da76b70bf1690db4eae29c5f1badd03c5ccf2a55d705ddcd86d449511ceb7ec30bf12b1fa35b913f9f747a8afd1b130e"
+		"94bff94effd01a91735ca1726acd0b197c4e5b03393697e126826fb6bbde8ecc1e08298516e2c9ed03ff3c1b7860f6de76d4cecd94c8119855ef5297ca67e9f3"
+		"e7ff72b1e99785ca0a7e7720c5b36dc6d72cac9574c8cbbc2f801e23e56fd344b07f22154beba0f08ce8891e643ed995c94d9a69c9f1b5f499027a78572aeebd"
+		"74d20cc39881c213ee770b1010e4bea718846977ae119f7a023ab58cca0ad752afe656bb3c17256a9f6e9bf19fdd5a38fc82bbe872c5539edb609ef4f79c203e"
+		"bb140f2e583cb2ad15b4aa5b655016a8449277dbd477ef2c8d6c017db738b18deb4a427d1923ce3ff262735779a418f20a282df920147beabe421ee5319d0568"},
+};
+
+long selftestXTS(){
+	long failed = 0;
+	int count = (int) (sizeof(xts_vectors)/sizeof(xts_vectors[0]));
+	unsigned char key[32], pt[512], out[512], back[512];
+	XTSKey xts;
+	for(int v = 0; v < count; ++v){
+		const XTSVector* t = xts_vectors + v;
+		long len = 512;
+		if(t->pt != NULL){
+			len = selftestHex(t->pt, pt);
+		}
+		else{
+			for(long i = 0; i < len; ++i){
+				pt[i] = (unsigned char) i;
+			}
+		}
+		selftestHex(t->key, key);
+		xtsInit(&xts, key);
+		selftestCheck("xts", v, "data unit refused", xtsCryptUnits(&xts, len, t->unit, pt, out, len, 0), &failed);
+		selftestExpect("xts", v, "ciphertext", out, len, t->ct, &failed);
+		xtsCryptUnits(&xts, len, t->unit, out, back, len, 1);
+		selftestCheck("xts", v, "wrong plaintext", memcmp(back, pt, len) == 0, &failed);
+	}
+	//a short object of three 32 byte data units under the vector 4 key: every range must equal the same slice of
+	//the whole decryption
+	int ranges_ok = 1;
+	for(long i = 0; i < 96; ++i){
+		pt[i] = (unsigned char) (5*i + 3);
+	}
+	xtsCryptUnits(&xts, 32, 0, pt, out, 96, 0);
+	for(long offset = 0; offset <= 96; ++offset){
+		for(long len = 0; offset + len <= 96; ++len){
+			memset(back, 0, sizeof(back));
+			ranges_ok &= xtsDecryptRange(&xts, 32, out, offset, len, back) && memcmp(back, pt + offset, len) == 0;
+		}
+	}
+	selftestCheck("xts", count, "a range differs from the whole decryption", ranges_ok, &failed);
+	return failed;
+}
+
+/* The fixed-key hash must be pi(x) ^ x for every block, through the 8-way kernel on AES-NI. FIPS-197 appendix
+   C.1 gives pi of one block */
+long selftestFixedKeyHash(){
+	long failed = 0;
+	const long n = 2*LANES + 3;
+	unsigned char key[16], in[16*n], out[16*n], expected[16*n];
+	FixedKeyHash h;
+	selftestHex("000102030405060708090a0b0c0d0e0f", key);
+	fixedKeyHashInit(&h, key);
+	selftestHex("00112233445566778899aabbccddeeff", in);
+	fixedKeyHash(&h, in, out, 1);
+	selftestExpect("fixed-key", 0, "hash", out, 16, "69d5c2eb2e2e624750541d3bbc692ba5", &failed);
+	for(long i = 0; i < 16*n; ++i){
+		in[i] = (unsigned char) (3*i + 1);
+	}
+	encryptBlocks(in, expected, (int) n, h.expanded_key);
+	xorBytes(expected, in, expected, (int) (16*n));
+	for(long count = 0; count <= n; ++count){
+		memset(out, 0, sizeof(out));
+		fixedKeyHash(&h, in, out, count);
+		selftestCheck("fixed-key", 1, "differs from encryptBlocks(x) ^ x", memcmp(out, expected, 16*count) == 0
+			&& selftestZeroed(out + 16*count, 16*(n - count)), &failed);
+	}
+	memcpy(out, in, sizeof(in));
+	fixedKeyHash(&h, out, out, n);
+	selftestCheck("fixed-key", 2, "differs in place", memcmp(out, expected, sizeof(out)) == 0, &failed);
+	return failed;
+}
+
+/* One instantiate, reseed, generate, generate run of CTR_DRBG AES-128 without a derivation function. The
+   second 64 byte output is the answer */
+struct DRBGVector {
+	const char* entropy;
+	const char* personalization;
+	const char* entropy_reseed;
+	const char* additional_reseed;
+	const char* additional1;
+	const char* additional2;
+	const char* returned;
+};
+
+/* NIST CAVP drbgvectors_pr_false CTR_DRBG AES-128 no df COUNT 0, then personalization and additional input
+   of full and short length, with the answers checked against OpenSSL */
+static const DRBGVector drbg_vectors[] = {
+	{"ed1e7f21ef66ea5d8e2a85b9337245445b71d6393a4eecb0e63c193d0f72f9a9", "",
+		"303fb519f0a4e17d6df0b6426aa0ecb2a36079bd48be47ad2a8dbfe48da3efad", "", "", "",
+		"f80111d08e874672f32f42997133a5210f7a9375e22cea70587f9cfafebe0f6a"
+		"6aa2eb68e7dd9164536d53fa020fcab20f54caddfab7d6d91e5ffec1dfd8deaa"},
+	{"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f",
+		"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+		"909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeaf",
+		"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf",
+		"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf",
+		"88f57c4fae87a486d0918c4461d5b5b871bd7fcef1fc362e35e7af5b754b0944"
+		"be5000a2a095f0f9fb574f7bcf409a395377f34cb0302d80dfa9c1fdea65aaa8"},
+	{"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+		"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f",
+		"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f", "",
+		"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf", "0102030405",
+		"3431f8c17fa48120d67bfe1b3bd891f5b37449a81ed45e87debb02c9f94f6353"
+		"b92c41358648ae5c1e09ce6f61054a36c7e6ef9ea05b2cb0c6af72ef742fb2b5"},
+};
+
+long selftestDRBG(){
+	long failed = 0;
+	const int count = sizeof(drbg_vectors)/sizeof(drbg_vectors[0]);
+	unsigned char entropy[DRBG_SEED_LEN], reseed[DRBG_SEED_LEN], pers[DRBG_SEED_LEN + 1], add_reseed[DRBG_SEED_LEN];
+	unsigned char add1[DRBG_SEED_LEN], add2[DRBG_SEED_LEN], out[64], first[64];
+	CTRDRBG* drbg = new CTRDRBG; //too big for the stack of a thread
+	for(int v = 0; v < count; ++v){
+		const DRBGVector* t = drbg_vectors + v;
+		selftestHex(t->entropy, entropy);
+		selftestHex(t->entropy_reseed, reseed);
+		int pers_len = (int) selftestHex(t->personalization, pers);
+		int add_reseed_len = (int) selftestHex(t->additional_reseed, add_reseed);
+		int add1_len = (int) selftestHex(t->additional1, add1);
+		int add2_len = (int) selftestHex(t->additional2, add2);
+		drbgInstantiate(drbg, entropy, pers, pers_len);
+		drbgReseed(drbg, reseed, add_reseed, add_reseed_len);
+		selftestCheck("ctr-drbg", v, "first generate refused", drbgGenerate(drbg, first, 64, add1, add1_len), &failed);
+		selftestCheck("ctr-drbg", v, "second generate refused", drbgGenerate(drbg, out, 64, add2, add2_len), &failed);
+		selftestExpect("ctr-drbg", v, "output", out, 64, t->returned, &failed);
+		//a short request is the front of the same keystream
+		drbgInstantiate(drbg, entropy, pers, pers_len);
+		drbgReseed(drbg, reseed, add_reseed, add_reseed_len);
+		memset(out, 0, sizeof(out));
+		drbgGenerate(drbg, out, 41, add1, add1_len);
+		selftestCheck("ctr-drbg", v, "short generate differs", memcmp(out, first, 41) == 0 && selftestZeroed(out + 41, 23), &failed);
+	}
+	//without a derivation function inputs longer than the seed length must be refused, not cut short
+	memset(pers, 7, sizeof(pers));
+	selftestCheck("ctr-drbg", count, "long personalization accepted", !drbgInstantiate(drbg, entropy, pers, DRBG_SEED_LEN + 1), &failed);
+	drbgInstantiate(drbg, entropy, NULL, 0);
+	selftestCheck("ctr-drbg", count, "long reseed input accepted", !drbgReseed(drbg, reseed, pers, DRBG_SEED_LEN + 1), &failed);
+	selftestCheck("ctr-drbg", count, "long additional input accepted", !drbgGenerate(drbg, out, 16, pers, DRBG_SEED_LEN + 1), &failed);
+	delete drbg;
+	return failed;
+}
+
+/* Digests of both hashes, serial and multi-lane, over msg[i] = 7i + 1, from an independent implementation of
+   the constructions above. The lengths cover no block, a tail that fits one padding block, a tail that needs
+   two, a whole block, and a full row of lanes plus a tail (the multi-lane digests assume LANES is 8) */
+struct HashVector {
+	int kind;
+	long len;
+	const char* serial;
+	const char* lanes;
+};
+
+static const HashVector hash_vectors[] = {
+	{HASH_MMO, 0, "bad78e726c1ec02b7ebfe92b23d9ec34", "7ef9270386316d3076dce24e968fa2fa"},
+	{HASH_MMO, 7, "67199797b9515a036710260bfb160b87", "0057da57ff1e3315355956c9a76c8b0e"},
+	{HASH_MMO, 8, "227e22a55b890e56265cad14f2cece17", "528460179e5de37141f920f70ae189c3"},
+	{HASH_MMO, 16, "bb9aef9013f6aeaba309e27d9d5e880f", "a9e31cbce386dba0ab35ad101b4bf241"},
+	{HASH_MMO, 16*8 + 9, "c5a1a3c6a65249d8beba68a7bfe407b8", "ca1ab29d0e24ad0edbbc943db0a03c47"},
+	{HASH_DM, 0, "0edd33d3c621e546455bd8ba1418bec8", "1eb00f97be74a26521371ad61b4f4919"},
+	{HASH_DM, 7, "3e2ff161bedee678c7b80db4108e1430", "9e9ebcd89f646f812bede12148cbd985"},
+	{HASH_DM, 8, "fd58f073932f16cc99cc9822e0f4dff5", "89fbf06c934754b6152c2d6e6ebd87e6"},
+	{HASH_DM, 16, "f67e6c7ae931bdeec92ea31c0f4da00d", "22e868aad7be81c4e28541c1f2788675"},
+	{HASH_DM, 16*8 + 9, "86afdc0d6e601b75131aec82fb49684f", "5ba6f6d67fe305635a90bbb2a0b2054e"},
+};
+
+long selftestHash(){
+	long failed = 0;
+	const int count = sizeof(hash_vectors)/sizeof(hash_vectors[0]);
+	unsigned char msg[16*8 + 9], digest[16];
+	for(long i = 0; i < (long) sizeof(msg); ++i){
+		msg[i] = (unsigned char) (7*i + 1);
+	}
+	for(int v = 0; v < count; ++v){
+		const HashVector* t = hash_vectors + v;
+		blockHash(t->kind, msg, t->len, digest);
+		selftestExpect("mmo/dm", v, "serial digest", digest, 16, t->serial, &failed);
+		if(LANES == 8){
+			blockHashLanes(t->kind, msg, t->len, digest);
+			selftestExpect("mmo/dm", v, "multi-lane digest", digest, 16, t->lanes, &failed);
+		}
+	}
+	return failed;
+}
+
+/* A known answer for the streaming ECB and CBC modes. iv is NULL for ECB, pt is cut to len bytes */
+struct StreamVector {
+	const char* key;
+	const char* iv;
+	int pad;
+	int cts;
+	const char* pt;
+	long len;
+	const char* ct;
+};
+
+/* The RFC 3962 appendix B plaintext and key */
+static const char* cts_key = "636869636b656e207465726979616b69";
+static const char* cts_pt = "4920776f756c64206c696b65207468652047656e6572616c20476175277320"
+	"436869636b656e2c20706c656173652c20616e6420776f6e746f6e20736f75702e";
+
+/* NIST SP 800-38A F.1.1, then PKCS#7 padding on a partial last block */
+static const StreamVector ecb_vectors[] = {
+	{"2b7e151628aed2a6abf7158809cf4f3c", NULL, 0, 0, ctr_pt, 64, "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf"
+		"43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4"},
+	{"2b7e151628aed2a6abf7158809cf4f3c", NULL, 1, 0, ctr_pt, 37, "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf"
+		"77b94bb7598033e8e309cf4c6cbb4e40"},
+	{"2b7e151628aed2a6abf7158809cf4f3c", NULL, 1, 0, ctr_pt, 64, "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf"
+		"43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4a254be88e037ddd9d79fb6411c3f9df8"},
+};
+
+/* NIST SP 800-38A F.2.1, then PKCS#7 padding on a partial last block */
+static const StreamVector cbc_vectors[] = {
+	{"2b7e151628aed2a6abf7158809cf4f3c", "000102030405060708090a0b0c0d0e0f", 0, 0, ctr_pt, 64,
+		"7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b273bed6b8e3c1743b7116e69e22229516"
+		"3ff1caa1681fac09120eca307586e1a7"},
+	{"2b7e151628aed2a6abf7158809cf4f3c", "000102030405060708090a0b0c0d0e0f", 1, 0, ctr_pt, 37,
+		"7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b25dd91dde9c980257336717a3c680d405"},
+	{"2b7e151628aed2a6abf7158809cf4f3c", "000102030405060708090a0b0c0d0e0f", 1, 0, ctr_pt, 64,
+		"7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b273bed6b8e3c1743b7116e69e22229516"
+		"3ff1caa1681fac09120eca307586e1a78cb82807230e1321d3fae00d18cc2012"},
+};
+
+/* RFC 3962 appendix B is CBC-CS3 under a zero iv. The CS1, CS2 and ECB-CTS answers on the same key and
+   plaintext are from an independent implementation of the SP 800-38A addendum */
+static const StreamVector cts_vectors[] = {
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 17, "c6353568f2bf8cb4d8a580362da7ff7f97"},
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 31, "fc00783e0efdb2c1d445d4c8eff7ed2297687268d6ecccc0c07b25e25ecfe5"},
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 32, "39312523a78662d5be7fcbcc98ebf5a897687268d6ecccc0c07b25e25ecfe584"},
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 47,
+		"97687268d6ecccc0c07b25e25ecfe584b3fffd940c16a18c1b5549d2f838029e39312523a78662d5be7fcbcc98ebf5"},
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 48,
+		"97687268d6ecccc0c07b25e25ecfe5849dad8bbb96c4cdc03bc103e1a194bbd839312523a78662d5be7fcbcc98ebf5a8"},
+	{cts_key, "00000000000000000000000000000000", 0, 3, cts_pt, 64,
+		"97687268d6ecccc0c07b25e25ecfe58439312523a78662d5be7fcbcc98ebf5a84807efe836ee89a526730dbc2f7bc840"
+		"9dad8bbb96c4cdc03bc103e1a194bbd8"},
+	{cts_key, "00000000000000000000000000000000", 0, 1, cts_pt, 17, "97c6353568f2bf8cb4d8a580362da7ff7f"},
+	{cts_key, "00000000000000000000000000000000", 0, 1, cts_pt, 47,
+		"97687268d6ecccc0c07b25e25ecfe58439312523a78662d5be7fcbcc98ebf5b3fffd940c16a18c1b5549d2f838029e"},
+	{cts_key, "00000000000000000000000000000000", 0, 2, cts_pt, 31, "fc00783e0efdb2c1d445d4c8eff7ed2297687268d6ecccc0c07b25e25ecfe5"},
+	{cts_key, "00000000000000000000000000000000", 0, 2, cts_pt, 48,
+		"97687268d6ecccc0c07b25e25ecfe58439312523a78662d5be7fcbcc98ebf5a89dad8bbb96c4cdc03bc103e1a194bbd8"},
+	{cts_key, NULL, 0, 3, cts_pt, 17, "3becd2e3f840bde61a02946baaefe44397"},
+	{cts_key, NULL, 0, 3, cts_pt, 31, "2fb51293e9988c7b9f1a053522f123d997687268d6ecccc0c07b25e25ecfe5"},
+	{cts_key, NULL, 0, 3, cts_pt, 47, "97687268d6ecccc0c07b25e25ecfe584d3583dd8fcd808e8da51014371d610b1230c15eacecdc08fc1e2b658760fff"},
+	{cts_key, NULL, 0, 3, cts_pt, 48,
+		"97687268d6ecccc0c07b25e25ecfe584230c15eacecdc08fc1e2b658760fff8ac92e304ee296c4fa77175486d86fb2fb"},
+};
+
+/* Run len bytes through a fresh stream in pieces of at most piece bytes. Returns the output length, or -1 if
+   streamFinal refused the input */
+long selftestStreamRun(const StreamVector* t, const unsigned char* expanded_key, int decrypt, const unsigned char* in,
+		long len, long piece, unsigned char* out){
+	BlockStream s;
+	unsigned char iv[16];
+	if(t->iv != NULL){
+		selftestHex(t->iv, iv);
+	}
+	streamInit(&s, (unsigned char*) expanded_key, t->iv != NULL ? STREAM_CBC : STREAM_ECB, decrypt, t->pad, t->cts,
+		t->iv != NULL ? iv : NULL);
+	long written = 0;
+	for(long pos = 0; pos < len; pos += piece){
+		written += streamUpdate(&s, in + pos, len - pos < piece ? len - pos : piece, out + written);
+	}
+	long last = streamFinal(&s, out + written);
+	return last < 0 ? -1 : written + last;
+}
+
+/* Each vector both ways, whole and in 1, 7 and 16 byte pieces, so held partial blocks cross every update */
+long selftestStream(const char* mode, const StreamVector* vectors, int count){
+	long failed = 0;
+	unsigned char key[16], expanded_key[176], pt[96], ct[96], out[96 + 32];
+	const long pieces[] = {96, 1, 7, 16};
+	for(int v = 0; v < count; ++v){
+		const StreamVector* t = vectors + v;
+		selftestHex(t->key, key);
+		expandKey(key, 16, expanded_key, 176);
+		selftestHex(t->pt, pt);
+		long ct_len = selftestHex(t->ct, ct);
+		for(int p = 0; p < 4; ++p){
+			long n = selftestStreamRun(t, expanded_key, 0, pt, t->len, pieces[p], out);
+			selftestCheck(mode, v, "encryption refused", n >= 0, &failed);
+			if(n >= 0){
+				selftestExpect(mode, v, "ciphertext", out, n, t->ct, &failed);
+			}
+			n = selftestStreamRun(t, expanded_key, 1, ct, ct_len, pieces[p], out);
+			selftestCheck(mode, v, "wrong plaintext", n == t->len && memcmp(out, pt, n) == 0, &failed);
+		}
+		if(t->pad){
+			ct[ct_len - 1] ^= 0x01; //the padding no longer checks out
+			selftestCheck(mode, v, "bad padding accepted", selftestStreamRun(t, expanded_key, 1, ct, ct_len, 96, out) < 0, &failed);
+		}
+		else{
+			//without padding a partial last block (or for stealing a single one) is refused
+			long short_len = t->cts ? 15 : t->len - 1;
+			selftestCheck(mode, v, "short input accepted", selftestStreamRun(t, expanded_key, 0, pt, short_len, 96, out) < 0, &failed);
+		}
+	}
+	return failed;
+}
+
+long selftestECB(){
+	return selftestStream("ecb", ecb_vectors, sizeof(ecb_vectors)/sizeof(ecb_vectors[0]));
+}
+
+long selftestCBC(){
+	return selftestStream("cbc", cbc_vectors, sizeof(cbc_vectors)/sizeof(cbc_vectors[0]));
+}
+
+long selftestCTS(){
+	return selftestStream("cts", cts_vectors, sizeof(cts_vectors)/sizeof(cts_vectors[0]));
+}
+
+/* Every mode on every engine the cpu has. Returns the number of failed checks */
+long runSelftest(){
+	const char* modes[] = {"cbc", "ccm", "cfb", "cmac", "container", "ctr", "ctr-drbg", "cts", "ecb", "ff1/ff3-1", "fixed-key", "gcm", "gcm-siv", "kw", "mmo/dm", "ocb", "ofb", "siv", "xts"};
+	long (*tests[])() = {selftestCBC, selftestCCM, selftestCFB, selftestCMAC, selftestContainer, selftestCTR, selftestDRBG, selftestCTS, selftestECB, selftestFPE, selftestFixedKeyHash, selftestGCM, selftestGCMSIV, selftestKeyWrap, selftestHash, selftestOCB, selftestOFB, selftestSIV, selftestXTS};
+	int had_aesni = use_aesni;
+	long failed = 0;
+	for(int engine = 0; engine < 2; ++engine){
+		if(engine == 1 && !had_aesni){
+			break;
+		}
+		use_aesni = engine;
+		for(size_t m = 0; m < sizeof(tests)/sizeof(tests[0]); ++m){
+			long f = tests[m]();
+			printf("%-9s %-9s %s\n", engine == 1 ? "aes-ni" : "reference", modes[m], f == 0 ? "ok" : "FAILED");
+			failed += f;
+		}
+	}
+	use_aesni = had_aesni;
+	return failed;
+}
+
+/* Usage: aes [--cbc] [--pkcs7 | --cts | --cs1 | --cs2 | --cs3] [--decrypt] [--hex | --base64] [--memo]
+       aes --seal | --open [--chunk BYTES] [--threads N]
+   both with [--in FILE] [--out FILE], and
+       aes [--cbc] [--cts | --cs1 | --cs2 | --cs3] [--decrypt] --in-place FILE
+       aes [--cbc] [--pkcs7 | --cts | --cs1 | --cs2 | --cs3] [--decrypt] --batch DIR|MANIFEST [--out-dir DIR] [--threads N]
+   stdin holds the 16 byte key, in CBC mode followed by the 16 byte IV, and then the data. Without options the
+   data is encrypted in ECB mode, which is what the original version did. --cts is CBC-CS3 (or ECB-CTS).
+   --seal and --open write and read the chunked GCM container. --in and --out take the data from and write it to
+   files instead, the key and IV still come from stdin. Given both, ECB and CBC run on memory mapped files.
+   --uring moves ECB and CBC I/O to io_uring, falling back to plain reads and writes where it is unavailable.
+   --pipeline runs reading, the cipher (on --threads threads where the mode allows) and writing concurrently.
+   --in-place overwrites FILE with its encryption (or decryption), resuming from its journal after a crash.
+   --direct bypasses the page cache with O_DIRECT, it needs both --in and --out.
+   --batch runs every file of DIR, or every "input [output]" line of MANIFEST, on --threads workers.
+   --hex and --base64 read the key, IV and data as text and write text, with the plain stream only.
+   --memo answers repeated ECB blocks from a table, for low entropy input on cpus without AES-NI.
+   Otherwise output to a pipe goes out with vmsplice */
+int main(int argc, char** argv){
+	int mode = STREAM_ECB;
+	int pad = 0;
+	int decrypt = 0;
+	int cts = 0;
+	int container = 0; //1 seal, 2 open
+	long container_chunk = 1 << 16;
+	int threads = (int) std::thread::hardware_concurrency();
+	const char* in_path = NULL;
+	const char* out_path = NULL;
+	int uring = 0;
+	int pipeline = 0;
+	int direct = 0;
+	const char* in_place = NULL;
+	const char* batch = NULL;
+	const char* out_dir = NULL;
+	int codec = CODEC_RAW;
+	int memo = 0;
+	for(int i = 1; i < argc; ++i){
+		if(strcmp(argv[i], "--bench-hash") == 0){
+			benchHash();
+			return 0;
+		}
+		else if(strcmp(argv[i], "--selftest") == 0){
+			return runSelftest() != 0;
+		}
+		else if(strcmp(argv[i], "--cbc") == 0){
+			mode = STREAM_CBC;
+		}
+		else if(strcmp(argv[i], "--pkcs7") == 0){
+			pad = 1;
+		}
+		else if(strcmp(argv[i], "--decrypt") == 0){
+			decrypt = 1;
+		}
+		else if(strcmp(argv[i], "--cts") == 0 || strcmp(argv[i], "--cs3") == 0){
+			cts = 3;
+		}
+		else if(strcmp(argv[i], "--cs1") == 0){
+			cts = 1;
+		}
+		else if(strcmp(argv[i], "--cs2") == 0){
+			cts = 2;
+		}
+		else if(strcmp(argv[i], "--seal") == 0){
+			container = 1;
+		}
+		else if(strcmp(argv[i], "--open") == 0){
+			container = 2;
+		}
+		else if(strcmp(argv[i], "--chunk") == 0 && i + 1 < argc){
+			container_chunk = atol(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			threads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--uring") == 0){
+			uring = 1;
+		}
+		else if(strcmp(argv[i], "--pipeline") == 0){
+			pipeline = 1;
+		}
+		else if(strcmp(argv[i], "--direct") == 0){
+			direct = 1;
+		}
+		else if(strcmp(argv[i], "--memo") == 0){
+			memo = 1;
+		}
+		else if(strcmp(argv[i], "--hex") == 0){
+			codec = CODEC_HEX;
+		}
+		else if(strcmp(argv[i], "--base64") == 0){
+			codec = CODEC_BASE64;
+		}
+		else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc){
+			batch = argv[++i];
+		}
+		else if(strcmp(argv[i], "--out-dir") == 0 && i + 1 < argc){
+			out_dir = argv[++i];
+		}
+		else if(strcmp(argv[i], "--in-place") == 0 && i + 1 < argc){
+			in_place = argv[++i];
+		}
+		else if(strcmp(argv[i], "--in") == 0 && i + 1 < argc){
+			in_path = argv[++i];
+		}
+		else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc){
+			out_path = argv[++i];
+		}
+		else{
+			cerr << "usage: aes [--cbc] [--pkcs7 | --cts | --cs1 | --cs2 | --cs3] [--decrypt] [--hex | --base64] [--memo] [--bench-hash] [--selftest]\n"
+				 << "       aes --seal | --open [--chunk BYTES] [--threads N]\n"
+				 << "       either form with [--in FILE] [--out FILE], ECB and CBC also with [--uring | --pipeline | --direct]\n"
+				 << "       aes [--cbc] [--cts | --cs1 | --cs2 | --cs3] [--decrypt] --in-place FILE\n"
+				 << "       aes [--cbc] [--pkcs7 | --cts | --cs1 | --cs2 | --cs3] [--decrypt] --batch DIR|MANIFEST [--out-dir DIR] [--threads N]\n";
+			return 1;
+		}
+	}
+	if(threads < 1){
+		threads = 1;
+	}
+	if(container_chunk < 1 || container_chunk > CONTAINER_MAX_CHUNK){
+		cerr << "aes: chunk size must be between 1 byte and 1 GiB\n";
+		return 1;
+	}
+	if(codec != CODEC_RAW && (container || uring || pipeline || direct || in_place != NULL || batch != NULL)){
+		cerr << "aes: --hex and --base64 only work with the plain stream\n";
+		return 1;
+	}
+	if(memo && (mode != STREAM_ECB || container || pipeline || batch != NULL)){
+		cerr << "aes: --memo is for ECB on a single stream\n";
+		return 1;
+	}
+	if(direct && (in_path == NULL || out_path == NULL)){
+		cerr << "aes: --direct needs --in and --out\n";
+		return 1;
+	}
+	if(pad && cts){
+		cerr << "aes: padding and ciphertext stealing exclude each other\n";
+		return 1;
+	}
+	unsigned char *key;
+	//One block is 16 bytes (128 bits), initialize arrays:
+	key = new unsigned char[16];
+	if(codec != CODEC_RAW ? readText(0, codec, key, 16) != 0 : readFull(0, key, 16) != 16){ //Read 16 bytes straight into the key array. This represents the key
+		cerr << "aes: input ends before the 16 byte key\n";
+		return 1;
+	}
+	//The key is now stored in the key array
+
+	//Now, expand the key, theory implemented from https://en.wikipedia.org/wiki/Rijndael_key_schedule#The_key_schedule
+    unsigned char expanded_key[176];
+
+    //Call expandKey:
+    //expandKey(unsigned char *key, int key_size, unsigned char *expanded_key, int expanded_key_size)
+    expandKey(key, 16, expanded_key, 176);
+  
+
+    //read the IV after the key in CBC mode
+    unsigned char iv[16] = {0};
+    if(mode == STREAM_CBC && (codec != CODEC_RAW ? readText(0, codec, iv, 16) != 0 : readFull(0, iv, 16) != 16)){
+    	cerr << "aes: input ends before the 16 byte IV\n";
+    	return 1;
+    }
+
+    int in_fd = 0;
+    int out_fd = 1;
+    if(in_path != NULL && (in_fd = open(in_path, O_RDONLY)) < 0){
+    	cerr << "aes: cannot open " << in_path << "\n";
+    	return 1;
+    }
+    if(out_path != NULL && (out_fd = open(out_path, O_RDWR | O_CREAT, 0644)) < 0){ //truncated once it is known not to be the input
+    	cerr << "aes: cannot open " << out_path << "\n";
+    	return 1;
+    }
+    struct stat in_st, out_st;
+    if(out_path != NULL && fstat(out_fd, &out_st) == 0 && S_ISREG(out_st.st_mode)){
+    	if(fstat(in_fd, &in_st) == 0 && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino){
+    		cerr << "aes: the output is the input file, use --in-place\n";
+    		return 1;
+    	}
+    	if(ftruncate(out_fd, 0) != 0){
+    		cerr << "aes: cannot truncate " << out_path << "\n";
+    		return 1;
+    	}
+    }
+
+    if(container){
+    	FILE* in_file = fdopen(in_fd, "rb");
+    	FILE* out_file = fdopen(out_fd, "wb");
+    	if(in_file == NULL || out_file == NULL){
+    		cerr << "aes: I/O error\n";
+    		return 1;
+    	}
+    	int sealed = container == 1 ? containerSeal(expanded_key, in_file, out_file, container_chunk, threads)
+    		: containerOpen(expanded_key, in_file, out_file, threads);
+    	if(fclose(out_file) != 0 && sealed == 0){
+    		sealed = 2;
+    	}
+    	fclose(in_file);
+    	if(sealed == 2){
+    		cerr << "aes: I/O error\n";
+    		return 1;
+    	}
+    	if(sealed == 1){
+    		cerr << (container == 1 ? "aes: input needs more than 2^32 chunks, use a larger --chunk\n"
+    			: "aes: container is damaged, truncated or was sealed under another key\n");
+    		return 1;
+    	}
+    	return 0;
+    }
+
+    //now we have finished the initial operations on the key, we will now read the data and run it through the stream.
+    //whole blocks go straight from the input buffer to the output buffer, only a partial tail is kept between reads
+    BlockStream stream;
+    streamInit(&stream, expanded_key, mode, decrypt, pad, cts, iv);
+    BlockMemo* block_memo = NULL;
+    if(memo){
+    	block_memo = new BlockMemo;
+    	memoInit(block_memo, expanded_key, decrypt);
+    	stream.memo = block_memo;
+    }
+    struct stat st;
+    int result;
+    if(batch != NULL){
+    	long failed = runBatch(&stream, batch, out_dir, threads);
+    	if(failed == -2){
+    		cerr << "aes: --out-dir is the source directory\n";
+    	}
+    	else if(failed < 0){
+    		cerr << "aes: cannot read " << batch << ", or outputs need --out-dir\n";
+    	}
+    	return failed != 0;
+    }
+    if(in_place != NULL){
+    	result = runInPlace(&stream, in_place);
+    	if(result == RUN_BAD_JOURNAL){
+    		cerr << "aes: " << in_place << ".journal belongs to another file, mode or key\n";
+    		return 1;
+    	}
+    	if(result == RUN_STREAM_ERROR){
+    		cerr << "aes: in place needs a length preserving mode, no padding, and whole blocks unless stealing\n";
+    		return 1;
+    	}
+    }
+    else if(codec != CODEC_RAW){
+    	result = runText(&stream, in_fd, out_fd, codec);
+    }
+    else if(pipeline){
+    	result = runPipeline(&stream, in_fd, out_fd, threads);
+    }
+    else if(direct && fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode)){
+#ifdef HAVE_IO_URING
+    	result = runDirect(&stream, in_fd, out_fd);
+#else
+    	result = runStream(&stream, in_fd, out_fd);
+#endif
+    }
+    else if(uring){
+#ifdef HAVE_IO_URING
+    	result = runUring(&stream, in_fd, out_fd, 0);
+#else
+    	result = runStream(&stream, in_fd, out_fd);
+#endif
+    }
+    else if(in_path != NULL && out_path != NULL && fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode) && S_ISREG(out_st.st_mode)){
+    	result = runMapped(&stream, in_fd, out_fd);
+    }
+#ifdef HAVE_VMSPLICE
+    else if(fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode)){
+    	result = runSplice(&stream, in_fd, out_fd);
+    }
+#endif
+    else{
+    	result = runStream(&stream, in_fd, out_fd);
+    }
+    if(result == RUN_IO_ERROR){
+    	cerr << "aes: I/O error\n";
+    	return 1;
+    }
+    if(result == RUN_BAD_TEXT){
+    	cerr << (codec == CODEC_HEX ? "aes: input is not valid hex\n" : "aes: input is not valid base64\n");
+    	return 1;
+    }
+    if(result == RUN_STREAM_ERROR){
+    	if(cts){
+    		cerr << "aes: ciphertext stealing needs at least one whole block\n";
+    	}
+    	else{
+    		cerr << (pad && decrypt ? "aes: invalid padding\n" : "aes: input is not a whole number of blocks, the tail was dropped\n");
+    	}
+    	return 1;
+    }
+    return 0;
 }